@@ -0,0 +1,197 @@
+#include "api.h"
+#include "archive.h"
+#include "context.h"
+#include "state.h"
+#include "translate.h"
+
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/IRReader/IRReader.h"
+
+#include <algorithm>
+#include <vector>
+
+using namespace llvm;
+
+std::optional<Lifter> parseLifter(const std::string& name) {
+    if (name == "cap")
+        return Lifter::Capstone;
+    if (name == "rem")
+        return Lifter::Remill;
+    if (name == "asl")
+        return Lifter::Asl;
+    return std::nullopt;
+}
+
+void Diagnostics::print(raw_ostream& os, const std::string& where) const {
+    if (category) {
+        TranslationError e{*category, message};
+        os << where << ": " << e.categoryName() << " error: " << message << '\n';
+    }
+    if (!verifier.empty())
+        os << where << ": verify failed:\n" << verifier;
+}
+
+static Diagnostics failure(const TranslationError& e) {
+    return Diagnostics{e.category, e.what(), ""};
+}
+
+static void verify(Module& m, Diagnostics& diag) {
+    raw_string_ostream os{diag.verifier};
+    verifyModule(m, &os);
+    os.flush();
+}
+
+Diagnostics translate(Module& m, Lifter lifter) {
+    try {
+        switch (lifter) {
+            case Lifter::Capstone: capstone(m); break;
+            case Lifter::Remill: remill(m); break;
+            case Lifter::Asl: asl(m); break;
+        }
+    } catch (const TranslationError& e) {
+        return failure(e);
+    }
+    Diagnostics diag{};
+    verify(m, diag);
+    return diag;
+}
+
+Translation translate(MemoryBufferRef buf, Lifter lifter) {
+    SMDiagnostic Err{};
+    auto m = parseIR(buf, Err, Context);
+    if (!m) {
+        std::string msg{};
+        raw_string_ostream os{msg};
+        Err.print(nullptr, os, false);
+        return {nullptr, Diagnostics{TranslationError::Input, os.str(), ""}};
+    }
+    auto diag = translate(*m, lifter);
+    return {std::move(m), std::move(diag)};
+}
+
+std::map<std::string, Diagnostics> unify(const std::map<std::string, Module*>& modules) {
+    std::map<std::string, Type*> globals;
+    std::map<std::string, Type*> loads;
+    std::map<std::string, Diagnostics> result;
+
+    for (auto& [_, Module] : modules) {
+        for (auto& var : Module->getGlobalList()) {
+            if (var.hasNUsesOrMore(1)) {
+                std::string name{var.getName()};
+                globals[name] = var.getValueType();
+            }
+        }
+
+        for (auto& fn : Module->getFunctionList()) {
+            if (fn.getName().startswith("load_") && fn.hasNUsesOrMore(1)) {
+                std::string name{fn.getName()};
+                loads[name] = fn.getReturnType();
+            }
+        }
+    }
+
+    // registers which are only read, and only in part, by every lifter
+    // are narrowed to the bits which are read.
+    std::map<std::string, BitRange> live;
+    for (auto& [_, Module] : modules) {
+        for (auto& [nm, range] : liveGlobalBits(*Module)) {
+            if (!live.contains(nm)) {
+                live[nm] = range;
+            } else {
+                live[nm].lo = std::min(live[nm].lo, range.lo);
+                live[nm].hi = std::max(live[nm].hi, range.hi);
+            }
+        }
+    }
+
+    for (auto& [nm, range] : live) {
+        // only registers which are integers of the same width in every
+        // module which uses them can be narrowed.
+        auto it = globals.find(nm);
+        if (it == globals.end() || !it->second->isIntegerTy())
+            continue;
+        bool sameType = std::all_of(modules.begin(), modules.end(), [&](auto& entry) {
+            auto* glo = entry.second->getNamedGlobal(nm);
+            return !glo || glo->use_empty() || glo->getValueType() == it->second;
+        });
+        unsigned wd = it->second->getIntegerBitWidth();
+        if (!sameType || range.lo >= range.hi || (range.lo == 0 && range.hi == wd))
+            continue;
+
+        for (auto& [_, Module] : modules) {
+            if (auto* glo = Module->getNamedGlobal(nm)) {
+                narrowGlobal(*Module, glo, range);
+            }
+        }
+        globals[nm] = Type::getIntNTy(Context, range.hi - range.lo);
+    }
+
+    for (auto& [name, Module] : modules) {
+        auto* root = findFunction(*Module, "root");
+
+        if (root) {
+            auto* entry = &root->getEntryBlock();
+
+            if (entry->getName() != "forced_vars") {
+                auto* entry2 = BasicBlock::Create(Context, "forced_vars", root, entry);
+
+                IRBuilder irb{entry2, entry2->begin()};
+                for (auto& [nm, ty] : globals) {
+                    auto* glo = Module->getNamedGlobal(nm);
+                    if (!glo) {
+                        // unified state is pruned to what each lifter uses.
+                        glo = new GlobalVariable(*Module, ty, false,
+                            GlobalValue::LinkageTypes::ExternalLinkage,
+                            Constant::getNullValue(ty), nm);
+                    }
+                    auto* load = irb.CreateLoad(ty, glo, "_" + nm);
+                    noundef(load);
+                }
+                irb.CreateBr(entry);
+            }
+        }
+
+        std::vector<GlobalVariable*> globals;
+        for (auto& glo : Module->getGlobalList()) {
+            globals.push_back(&glo);
+        }
+        try {
+            correctGlobalAccesses(globals);
+        } catch (const TranslationError& e) {
+            result[name] = failure(e);
+            continue;
+        }
+
+        verify(*Module, result[name]);
+    }
+    return result;
+}
+
+std::unique_ptr<Module> parseInput(const std::string& fname, SMDiagnostic& Err) {
+    if (auto key = archiveKey(fname)) {
+        Archive archive{key->first};
+        auto buf = archive.get(key->second);
+        if (!buf) {
+            Err = SMDiagnostic(fname, SourceMgr::DK_Error, "no such key in archive");
+            return nullptr;
+        }
+        return parseIR(*buf, Err, Context);
+    }
+    return parseIRFile(fname, Err, Context);
+}
+
+bool writeOutput(const std::string& fname, Module& m) {
+    if (auto key = archiveKey(fname)) {
+        std::string text;
+        raw_string_ostream os{text};
+        os << m;
+        return Archive{key->first}.put(key->second, os.str());
+    }
+    std::error_code Err;
+    raw_fd_ostream file{fname, Err};
+    if (Err)
+        return false;
+    file << m;
+    return true;
+}
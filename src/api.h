@@ -0,0 +1,74 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include "llvm/IR/Module.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "error.h"
+
+using namespace llvm;
+
+/**
+ * Interface of the translator library, for tools which translate lifter
+ * output in process rather than by running llvm-translator on files.
+ *
+ * Modules must belong to the global Context (see context.h), which uses
+ * opaque pointers. Translation happens in place, so a module already in
+ * memory is not copied or reparsed.
+ */
+
+enum class Lifter { Capstone, Remill, Asl };
+
+// "cap", "rem" or "asl", as on llvm-translator's command line.
+std::optional<Lifter> parseLifter(const std::string& name);
+
+/**
+ * Outcome of translating or unifying one module. A module with an error
+ * has been partly rewritten and should be discarded.
+ */
+struct Diagnostics {
+    std::optional<TranslationError::Category> category; // set on error
+    std::string message;
+    std::string verifier; // output of verifyModule, if it failed
+
+    bool ok() const { return !category && verifier.empty(); }
+
+    // as "WHERE: CATEGORY error: MESSAGE", or nothing if ok.
+    void print(raw_ostream& os, const std::string& where) const;
+};
+
+struct Translation {
+    std::unique_ptr<Module> module; // null if the input could not be parsed
+    Diagnostics diagnostics;
+};
+
+// translates the module in place to a root function over the unified state.
+Diagnostics translate(Module& m, Lifter lifter);
+
+// parses textual or bitcode IR and translates it. the buffer is not copied.
+Translation translate(MemoryBufferRef buf, Lifter lifter);
+
+/**
+ * Gives modules translated by different lifters the same set of globals,
+ * and narrows registers which every lifter only partly reads (the vars
+ * mode of llvm-translator). Errors are only found once the union has been
+ * taken, so a module with an error still contributes its globals and
+ * narrowing to the others. It should be discarded and not compared.
+ */
+std::map<std::string, Diagnostics> unify(const std::map<std::string, Module*>& modules);
+
+/**
+ * Parses an IR file, or a module stored in an archive as "ARCHIVE.ltar#KEY".
+ */
+std::unique_ptr<Module> parseInput(const std::string& fname, SMDiagnostic& Err);
+
+/**
+ * Writes a module to a file, or appends it to an archive as "ARCHIVE.ltar#KEY".
+ */
+bool writeOutput(const std::string& fname, Module& m);
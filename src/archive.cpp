@@ -0,0 +1,238 @@
+#include "archive.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static constexpr char MAGIC[4] = {'L', 'T', 'A', '1'};
+static constexpr size_t HEADER_SIZE = sizeof(MAGIC) + sizeof(uint32_t) + sizeof(uint64_t);
+static constexpr char INDEX_MAGIC[4] = {'L', 'T', 'I', '1'};
+static constexpr size_t ENTRY_HEADER_SIZE = sizeof(INDEX_MAGIC) + sizeof(uint32_t) + 2 * sizeof(uint64_t);
+
+static size_t padding(size_t n) {
+    return (8 - n % 8) % 8;
+}
+
+static size_t recordSize(uint64_t keySize, uint64_t dataSize) {
+    size_t size = HEADER_SIZE + keySize + dataSize + 1;
+    return size + padding(size);
+}
+
+// "LTI1" | u32 key size | u64 record offset | u64 data size | key | padding to 8 | u64 record end
+static std::string indexEntry(StringRef key, uint64_t offset, uint64_t dataSize) {
+    std::string entry{INDEX_MAGIC, sizeof(INDEX_MAGIC)};
+    uint32_t keySize = key.size();
+    uint64_t end = offset + recordSize(keySize, dataSize);
+    entry.append((const char*)&keySize, sizeof(keySize));
+    entry.append((const char*)&offset, sizeof(offset));
+    entry.append((const char*)&dataSize, sizeof(dataSize));
+    entry.append(key.begin(), key.end());
+    entry.append(padding(entry.size()), '\0');
+    entry.append((const char*)&end, sizeof(end));
+    return entry;
+}
+
+static bool writeAll(int fd, StringRef data) {
+    for (size_t done = 0; done < data.size(); ) {
+        ssize_t n = ::write(fd, data.data() + done, data.size() - done);
+        if (n <= 0)
+            return false;
+        done += n;
+    }
+    return true;
+}
+
+Archive::Archive(std::string path) : path_{std::move(path)} {
+    auto buf = MemoryBuffer::getFile(path_, /*IsText*/false,
+        /*RequiresNullTerminator*/false, /*IsVolatile*/true);
+    if (!buf)
+        return;
+    mapping = std::move(*buf);
+
+    // only records appended since the index was last written are scanned.
+    size_t indexed = loadIndex();
+    size_t scanned = scan(indexed);
+    if (scanned != indexed)
+        saveIndex();
+}
+
+size_t Archive::loadIndex() {
+    auto buf = MemoryBuffer::getFile(indexPath(), /*IsText*/false,
+        /*RequiresNullTerminator*/false, /*IsVolatile*/true);
+    if (!buf)
+        return 0;
+    const char* base = mapping->getBufferStart();
+    uint64_t size = mapping->getBufferSize();
+    StringRef entries = (*buf)->getBuffer();
+
+    std::map<std::string, StringRef> loaded{};
+    uint64_t covered = 0, last = 0;
+    for (size_t p = 0; entries.size() - p >= ENTRY_HEADER_SIZE; ) {
+        const char* e = entries.data() + p;
+        uint32_t keySize;
+        uint64_t offset, dataSize, end;
+        memcpy(&keySize, e + sizeof(INDEX_MAGIC), sizeof(keySize));
+        memcpy(&offset, e + sizeof(INDEX_MAGIC) + sizeof(keySize), sizeof(offset));
+        memcpy(&dataSize, e + sizeof(INDEX_MAGIC) + sizeof(keySize) + sizeof(offset), sizeof(dataSize));
+
+        size_t entrySize = ENTRY_HEADER_SIZE + keySize;
+        entrySize += padding(entrySize) + sizeof(end);
+        // an entry left incomplete by a crashed writer ends the index.
+        if (memcmp(e, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 || entries.size() - p < entrySize)
+            break;
+        memcpy(&end, e + entrySize - sizeof(end), sizeof(end));
+
+        // records outside the archive mean the index is of an older file.
+        if (offset > size || dataSize > size || end != offset + recordSize(keySize, dataSize) || end > size)
+            return 0;
+        loaded[std::string(e + ENTRY_HEADER_SIZE, keySize)] =
+            StringRef(base + offset + HEADER_SIZE + keySize, dataSize);
+        covered = end;
+        last = p;
+        p += entrySize;
+    }
+
+    // the last indexed record must be where the index says, or the archive
+    // has been replaced since.
+    if (covered) {
+        const char* e = entries.data() + last;
+        uint32_t keySize;
+        uint64_t offset;
+        memcpy(&keySize, e + sizeof(INDEX_MAGIC), sizeof(keySize));
+        memcpy(&offset, e + sizeof(INDEX_MAGIC) + sizeof(keySize), sizeof(offset));
+        const char* r = base + offset;
+        if (memcmp(r, MAGIC, sizeof(MAGIC)) != 0 || memcmp(r + sizeof(MAGIC), &keySize, sizeof(keySize)) != 0
+                || memcmp(r + HEADER_SIZE, e + ENTRY_HEADER_SIZE, keySize) != 0)
+            return 0;
+    }
+    index = std::move(loaded);
+    return covered;
+}
+
+size_t Archive::scan(size_t from) {
+    const char* p = mapping->getBufferStart() + from;
+    const char* end = mapping->getBufferEnd();
+    size_t scanned = from;
+    while (end - p >= (ptrdiff_t)HEADER_SIZE) {
+        uint32_t keySize;
+        uint64_t dataSize;
+        memcpy(&keySize, p + sizeof(MAGIC), sizeof(keySize));
+        memcpy(&dataSize, p + sizeof(MAGIC) + sizeof(keySize), sizeof(dataSize));
+
+        size_t size = recordSize(keySize, dataSize);
+        bool valid = memcmp(p, MAGIC, sizeof(MAGIC)) == 0
+            && (uint64_t)(end - p) >= size
+            && p[HEADER_SIZE + keySize + dataSize] == '\0'
+            && (end - p == (ptrdiff_t)size || memcmp(p + size, MAGIC, sizeof(MAGIC)) == 0);
+
+        if (!valid) {
+            // skip a record left incomplete by a crashed writer.
+            const void* next = memmem(p + 1, end - p - 1, MAGIC, sizeof(MAGIC));
+            if (!next)
+                break;
+            p = (const char*)next;
+            continue;
+        }
+
+        const char* key = p + HEADER_SIZE;
+        index[std::string(key, keySize)] = StringRef(key + keySize, dataSize);
+        p += size;
+        scanned = p - mapping->getBufferStart();
+    }
+    return scanned;
+}
+
+void Archive::saveIndex() const {
+    // entries in archive order, so the last one ends where the index does.
+    const char* base = mapping->getBufferStart();
+    std::vector<std::pair<uint64_t, const std::string*>> records{};
+    for (auto& [key, data] : index)
+        records.emplace_back(data.data() - base - HEADER_SIZE - key.size(), &key);
+    std::sort(records.begin(), records.end());
+
+    std::string entries{};
+    for (auto& [offset, key] : records)
+        entries += indexEntry(*key, offset, index.at(*key).size());
+
+    // under the archive's lock, so appends to the index are not lost in
+    // between. the index is only a cache, and failing to write it is not an error.
+    int lock = ::open(path_.c_str(), O_RDONLY);
+    if (lock < 0)
+        return;
+    flock(lock, LOCK_EX);
+    std::string tmp = indexPath() + ".tmp." + std::to_string(getpid());
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        bool ok = writeAll(fd, entries);
+        ::close(fd);
+        if (!ok || ::rename(tmp.c_str(), indexPath().c_str()) != 0)
+            ::unlink(tmp.c_str());
+    }
+    flock(lock, LOCK_UN);
+    ::close(lock);
+}
+
+std::optional<MemoryBufferRef> Archive::get(const std::string& key) const {
+    auto it = index.find(key);
+    if (it == index.end())
+        return std::nullopt;
+    // the identifier must outlive the buffer, so use the key owned by the index.
+    return MemoryBufferRef(it->second, it->first);
+}
+
+std::vector<std::string> Archive::keys() const {
+    std::vector<std::string> keys{};
+    for (auto& [key, _] : index)
+        keys.push_back(key);
+    return keys;
+}
+
+bool Archive::put(const std::string& key, StringRef data) {
+    std::string record{MAGIC, sizeof(MAGIC)};
+    uint32_t keySize = key.size();
+    uint64_t dataSize = data.size();
+    record.append((const char*)&keySize, sizeof(keySize));
+    record.append((const char*)&dataSize, sizeof(dataSize));
+    record.append(key);
+    record.append(data.begin(), data.end());
+    record.push_back('\0');
+    record.append(padding(record.size()), '\0');
+
+    int fd = ::open(path_.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd < 0)
+        return false;
+    flock(fd, LOCK_EX);
+
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0 && writeAll(fd, record);
+
+    // the index is appended to only if it covers the archive up to this
+    // record, i.e. its last entry ends here. otherwise the next open scans
+    // the records it is missing and rewrites it.
+    int idx = ok ? ::open(indexPath().c_str(), O_RDWR | O_APPEND | O_CREAT, 0644) : -1;
+    if (idx >= 0) {
+        struct stat ist;
+        uint64_t covered = 0;
+        if (fstat(idx, &ist) == 0 && ist.st_size >= (off_t)sizeof(covered)
+                && pread(idx, &covered, sizeof(covered), ist.st_size - sizeof(covered)) != sizeof(covered))
+            covered = UINT64_MAX;
+        if (covered == (uint64_t)st.st_size)
+            writeAll(idx, indexEntry(key, st.st_size, dataSize));
+        ::close(idx);
+    }
+
+    flock(fd, LOCK_UN);
+    ::close(fd);
+    return ok;
+}
+
+std::optional<std::pair<std::string, std::string>> archiveKey(const std::string& name) {
+    auto pos = name.find(".ltar#");
+    if (pos == std::string::npos)
+        return std::nullopt;
+    pos += strlen(".ltar");
+    return std::pair{name.substr(0, pos), name.substr(pos + 1)};
+}
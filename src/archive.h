@@ -0,0 +1,60 @@
+#pragma once 
+
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "llvm/Support/MemoryBuffer.h"
+
+using namespace llvm;
+
+/**
+ * Append-only archive of named files (lifter outputs, translated modules),
+ * replacing the per-opcode files under /tmp.
+ *
+ * The archive is a sequence of records, each
+ *   "LTA1" | u32 key size | u64 data size | key | data | NUL | padding to 8
+ * Later records replace earlier ones with the same key. The file is mapped
+ * on open, and record data is returned without copying. Data is followed by
+ * NUL so it can be parsed directly as textual IR.
+ *
+ * The offset of each record is kept in a sidecar index, ARCHIVE.idx, which
+ * appends also extend, so opening an archive reads the index rather than
+ * every record. Records the index is missing (e.g. appended by an older
+ * version) are found by scanning from where it ends, and it is rewritten.
+ * A missing or stale index only costs a full scan.
+ *
+ * Appends take an exclusive lock, so concurrent writers are safe. An
+ * incomplete record at the end (e.g. from a crash) is ignored.
+ */
+class Archive {
+public:
+    // a missing file is an empty archive.
+    explicit Archive(std::string path);
+
+    // data of the latest record with this key, valid while the archive lives.
+    std::optional<MemoryBufferRef> get(const std::string& key) const;
+    std::vector<std::string> keys() const;
+
+    // appends a record. not visible through this object until reopened.
+    bool put(const std::string& key, StringRef data);
+
+    const std::string& path() const { return path_; }
+
+private:
+    // loads the sidecar index, returning the archive offset it covers.
+    size_t loadIndex();
+    // indexes records from offset, returning the end of the last valid one.
+    size_t scan(size_t from);
+    void saveIndex() const;
+    std::string indexPath() const { return path_ + ".idx"; }
+
+    std::string path_;
+    std::unique_ptr<MemoryBuffer> mapping;
+    std::map<std::string, StringRef> index;
+};
+
+// splits "archive.ltar#key" into archive path and key.
+std::optional<std::pair<std::string, std::string>> archiveKey(const std::string& name);
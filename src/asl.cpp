@@ -1,4 +1,5 @@
 #include "context.h"
+#include "error.h"
 #include "state.h"
 #include "translate.h"
 
@@ -11,6 +12,8 @@ void asl(Module& m) {
 
   correctGlobalAccesses(globals);
   Function* root = findFunction(m, "root");
-  assert(root && "failed to find root function in asl");
+  if (!root)
+    unsupported(TranslationError::Input, "failed to find root function in asl");
   correctMemoryAccesses(m, *root);
+  pruneGlobalState(globals);
 }
@@ -0,0 +1,194 @@
+#include "canonical.h"
+
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/InlineAsm.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+
+using namespace llvm;
+
+unsigned Canonicaliser::intern(const std::string& key) {
+    auto [it, _] = table.try_emplace(key, table.size());
+    return it->second;
+}
+
+std::optional<unsigned> Canonicaliser::operand(Value* v) {
+    if (ids.contains(v))
+        return ids.at(v);
+
+    std::string key{};
+    raw_string_ostream os{key};
+    if (auto* arg = dyn_cast<Argument>(v)) {
+        os << "arg " << arg->getArgNo() << ' ' << *arg->getType();
+    } else if (auto* bb = dyn_cast<BasicBlock>(v)) {
+        if (!blocks.contains(bb))
+            return std::nullopt;
+        os << "block " << blocks.at(bb);
+    } else if (auto* glo = dyn_cast<GlobalVariable>(v)) {
+        os << "global " << glo->getName() << ' ' << *glo->getValueType();
+        if (glo->isConstant() && glo->hasInitializer())
+            os << " = " << *glo->getInitializer();
+    } else if (auto* fn = dyn_cast<Function>(v)) {
+        if (!fn->isDeclaration())
+            return std::nullopt;
+        os << "function " << fn->getName() << ' ' << *fn->getFunctionType();
+    } else if (isa<Constant>(v) || isa<MetadataAsValue>(v) || isa<InlineAsm>(v)) {
+        v->printAsOperand(os, true);
+    } else {
+        // an instruction in an unreachable block.
+        return std::nullopt;
+    }
+    return ids[v] = intern(os.str());
+}
+
+std::optional<std::vector<unsigned>> Canonicaliser::canonicalise(Function& fn) {
+    ids.clear();
+    blocks.clear();
+
+    // depth-first preorder, so every block comes after its dominators and
+    // operands are numbered before their uses (except in phis).
+    std::vector<BasicBlock*> order{};
+    std::vector<BasicBlock*> stack{&fn.getEntryBlock()};
+    while (!stack.empty()) {
+        auto* bb = stack.back();
+        stack.pop_back();
+        if (blocks.contains(bb))
+            continue;
+        blocks[bb] = order.size();
+        order.push_back(bb);
+        std::vector<BasicBlock*> succs{succ_begin(bb), succ_end(bb)};
+        stack.insert(stack.end(), succs.rbegin(), succs.rend());
+    }
+
+    std::string sig{};
+    raw_string_ostream sigos{sig};
+    sigos << *fn.getFunctionType() << ' ';
+    fn.getAttributes().print(sigos);
+    std::vector<unsigned> form{intern(sigos.str())};
+
+    std::vector<PHINode*> phis{};
+    unsigned allocas = 0;
+    unsigned effects = 0;
+    for (auto* bb : order) {
+        for (auto& phi : bb->phis()) {
+            std::string key{};
+            raw_string_ostream os{key};
+            os << "phi " << blocks.at(bb) << ' ' << phis.size() << ' ' << *phi.getType();
+            ids[&phi] = intern(os.str());
+            phis.push_back(&phi);
+        }
+
+        for (auto& inst : *bb) {
+            if (isa<PHINode>(inst))
+                continue;
+
+            std::string key{};
+            raw_string_ostream os{key};
+            os << inst.getOpcodeName() << ' ' << *inst.getType();
+
+            if (auto* op = dyn_cast<OverflowingBinaryOperator>(&inst)) {
+                if (op->hasNoUnsignedWrap()) os << " nuw";
+                if (op->hasNoSignedWrap()) os << " nsw";
+            }
+            if (auto* op = dyn_cast<PossiblyExactOperator>(&inst)) {
+                if (op->isExact()) os << " exact";
+            }
+            if (isa<FPMathOperator>(inst)) {
+                // nnan, ninf etc. change which results are poison.
+                inst.getFastMathFlags().print(os);
+            }
+            if (auto* call = dyn_cast<CallBase>(&inst)) {
+                // call site, return and argument attributes (noundef,
+                // nonnull, ...), and those of the callee if it is direct.
+                call->getAttributes().print(os);
+                if (auto* fn = call->getCalledFunction())
+                    fn->getAttributes().print(os);
+            }
+            if (auto* load = dyn_cast<LoadInst>(&inst)) {
+                os << (load->isVolatile() ? " volatile" : "") << " align " << load->getAlign().value();
+            } else if (auto* store = dyn_cast<StoreInst>(&inst)) {
+                os << (store->isVolatile() ? " volatile" : "") << " align " << store->getAlign().value();
+            } else if (auto* alloca = dyn_cast<AllocaInst>(&inst)) {
+                // distinct objects, even if they look the same.
+                os << ' ' << *alloca->getAllocatedType() << " #" << allocas++;
+            } else if (auto* gep = dyn_cast<GetElementPtrInst>(&inst)) {
+                os << ' ' << *gep->getSourceElementType() << (gep->isInBounds() ? " inbounds" : "");
+            } else if (auto* shuf = dyn_cast<ShuffleVectorInst>(&inst)) {
+                for (int m : shuf->getShuffleMask())
+                    os << ' ' << m;
+            } else if (auto* ev = dyn_cast<ExtractValueInst>(&inst)) {
+                for (unsigned i : ev->indices())
+                    os << ' ' << i;
+            } else if (auto* iv = dyn_cast<InsertValueInst>(&inst)) {
+                for (unsigned i : iv->indices())
+                    os << ' ' << i;
+            }
+            if (inst.hasMetadata(LLVMContext::MD_noundef))
+                os << " noundef";
+            if (inst.mayReadFromMemory())
+                os << " after " << effects;
+
+            std::vector<unsigned> ops{};
+            for (Value* v : inst.operands()) {
+                auto id = operand(v);
+                if (!id)
+                    return std::nullopt;
+                ops.push_back(*id);
+            }
+            if (auto* cmp = dyn_cast<CmpInst>(&inst)) {
+                // a < b is b > a, so the predicate follows the operand order.
+                auto pred = cmp->getPredicate();
+                if (ops[0] > ops[1]) {
+                    std::swap(ops[0], ops[1]);
+                    pred = CmpInst::getSwappedPredicate(pred);
+                }
+                os << ' ' << CmpInst::getPredicateName(pred);
+            } else if (ops.size() >= 2 && inst.isCommutative()) {
+                std::sort(ops.begin(), ops.begin() + 2);
+            }
+            for (unsigned id : ops)
+                os << " #" << id;
+
+            unsigned id = intern(os.str());
+            ids[&inst] = id;
+
+            // noundef loads are kept, since they make undefined values UB.
+            if (inst.mayHaveSideEffects() || inst.isTerminator() || inst.hasMetadata(LLVMContext::MD_noundef)) {
+                form.push_back(id);
+                effects++;
+            }
+        }
+    }
+
+    for (auto* phi : phis) {
+        std::vector<std::pair<unsigned, unsigned>> incoming{};
+        for (unsigned i = 0; i < phi->getNumIncomingValues(); i++) {
+            auto* pred = phi->getIncomingBlock(i);
+            if (!blocks.contains(pred))
+                continue;
+            auto id = operand(phi->getIncomingValue(i));
+            if (!id)
+                return std::nullopt;
+            incoming.emplace_back(blocks.at(pred), *id);
+        }
+        std::sort(incoming.begin(), incoming.end());
+        form.push_back(incoming.size());
+        for (auto [pred, id] : incoming) {
+            form.push_back(pred);
+            form.push_back(id);
+        }
+    }
+    return form;
+}
+
+bool structurallyEqual(Function& a, Function& b) {
+    Canonicaliser canon{};
+    auto x = canon.canonicalise(a);
+    auto y = canon.canonicalise(b);
+    return x && y && *x == *y;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "llvm/IR/Function.h"
+
+using namespace llvm;
+
+/**
+ * Canonical form of a function, for comparing lifter outputs without the
+ * solver. Two functions canonicalised by the same Canonicaliser have equal
+ * forms if they are identical up to value names, the order of operands of
+ * commutative instructions and comparisons, and the order of pure instructions between
+ * side effects. Dead instructions do not contribute to the form.
+ *
+ * Each value is hash-consed to an id from its opcode, type, flags (wrap,
+ * exact, fast-math), call site and callee attributes, and operand ids. Memory reads also take the number of preceding side effects.
+ * The form is the sequence of ids of side effects (stores, calls, noundef
+ * loads, terminators) and phi incoming values, in depth-first block order.
+ *
+ * Globals and declared functions are identified by name, so this is only
+ * meaningful between modules whose state has been unified (see vars).
+ */
+class Canonicaliser {
+public:
+    // nullopt if the function calls something with a body, which is not
+    // compared.
+    std::optional<std::vector<unsigned>> canonicalise(Function& fn);
+
+private:
+    unsigned intern(const std::string& key);
+    std::optional<unsigned> operand(Value* v);
+
+    std::map<std::string, unsigned> table;
+
+    // per function.
+    std::map<Value*, unsigned> ids;
+    std::map<BasicBlock*, unsigned> blocks;
+};
+
+bool structurallyEqual(Function& a, Function& b);
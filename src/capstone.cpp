@@ -1,4 +1,5 @@
 #include "context.h"
+#include "error.h"
 #include "state.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Type.h"
@@ -117,68 +118,75 @@ void capstone(Module& m) {
 
     ReturnInst* back = &uniqueReturn(f);
 
-    auto capstone = internaliseGlobals(m, f);
+    // retdec's registers are globals. these are classified by name and their
+    // uses moved straight onto the unified state, so the (mostly unused)
+    // system registers are never materialised.
+    // names are cleared first so they cannot clash with unified names.
+    std::vector<std::pair<GlobalVariable*, std::string>> capstone{};
+    for (auto& glo : m.globals()) {
+        capstone.emplace_back(&glo, glo.getName().str());
+        glo.setName("");
+    }
     auto unified = generateGlobalState(m, f);
 
     // here, cap refers to the capstone-specific variable
-    // glo is the allocated global
+    // glo is the unified global
     // reg is the abstract description
 
-    for (auto* cap : capstone) {
-        if (cap->user_empty()) {
-            // errs() << "erased unused capstone: " << *cap << '\n';
+    for (auto& [cap, nm] : capstone) {
+        if (cap->use_empty()) {
             cap->eraseFromParent();
             continue;
         }
-        std::string nm = cap->getName().str();
         auto stateOpt = discriminateGlobal(nm);
         if (stateOpt.has_value()) {
             // capstone variable is exactly a unified register.
             // replace all uses directly.
             StateReg reg = *stateOpt;
-            auto nm = reg.name();
             Type* ty = reg.ty();
 
-            GlobalVariable* glo = m.getNamedGlobal(nm);
-            assert(glo != nullptr && "unified global variable not found");
+            GlobalVariable* glo = m.getNamedGlobal(reg.name());
+            if (!glo)
+                unsupported(TranslationError::Variable, "unified global variable not found for " + nm, cap);
 
             assert(glo->getValueType() == ty);
-            if (cap->getAllocatedType() != ty) {
-                auto size = cap->getAllocatedType()->getPrimitiveSizeInBits().getFixedSize();
+            if (cap->getValueType() != ty) {
+                auto size = cap->getValueType()->getPrimitiveSizeInBits().getFixedSize();
                 Type* capIntTy = IntegerType::get(Context, size);
-                for (auto* use : cap->users()) {
+                for (auto* use : clone_it(cap->users())) {
                     if (auto* load = dyn_cast<LoadInst>(use)) {
                         IRBuilder irb{load};
                         auto* load2 = irb.CreateLoad(capIntTy, glo);
-                        auto* cast = irb.CreateBitCast(load2, cap->getAllocatedType());
+                        auto* cast = irb.CreateBitCast(load2, cap->getValueType());
                         load->replaceAllUsesWith(cast);
-                    } else if (auto* stor = dyn_cast<StoreInst>(use)) {
+                        load->eraseFromParent();
+                    } else if (auto* stor = dyn_cast<StoreInst>(use); stor && stor->getPointerOperand() == cap) {
                         IRBuilder irb{stor};
                         auto* cast = irb.CreateBitCast(stor->getValueOperand(), capIntTy);
-                        auto* stor2 = irb.CreateStore(cast, glo);
-                        stor->replaceAllUsesWith(stor2);
+                        irb.CreateStore(cast, glo);
+                        stor->eraseFromParent();
                     } else {
-                        errs() << *use << '\n';
-                        assert(false && "unsupported use of capstone alias register");
+                        unsupported(TranslationError::State, "unsupported use of capstone alias register " + nm, use);
                     }
-
                 }
             } else {
                 cap->replaceAllUsesWith(glo);
             }
-        } else if (!cap->hasName() && cap->getNumUses() <= 1) {
+        } else if (nm.empty() && cap->getNumUses() <= 1) {
             // eliminate: store volatile i64 0, i64* @0
             for (auto* use : clone_it(cap->users())) {
                 if (auto* inst = dyn_cast<Instruction>(use)) {
-                    assert(inst->isSafeToRemove());
+                    if (!inst->isSafeToRemove())
+                        unsupported(TranslationError::Variable, "unnamed capstone variable has a side-effecting use", inst);
                     inst->eraseFromParent();
                 }
             }
-            assert(cap->getNumUses() == 0);
         } else {
-            errs() << *cap << "\n";
-            assert(0 && "unhandled capstone variable");
+            unsupported(TranslationError::Variable, "unhandled capstone variable " + nm, cap);
         }
+        if (!cap->use_empty())
+            unsupported(TranslationError::Variable, "capstone variable " + nm + " is still used", cap);
+        cap->eraseFromParent();
     }
 
 
@@ -198,4 +206,5 @@ void capstone(Module& m) {
 
     correctGlobalAccesses(unified);
     correctMemoryAccesses(m, f);
+    pruneGlobalState(unified);
 }
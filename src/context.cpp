@@ -1,3 +1,6 @@
 #include "context.h"
 
 llvm::LLVMContext Context{};
+
+// llvm 14 specific. set before anything is parsed, including by library users.
+static const bool opaquePointers = (Context.enableOpaquePointers(), true);
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdexcept>
+#include <string>
+
+#include "llvm/IR/Value.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+/**
+ * Lifter output which the translators do not support. This is expected for
+ * some opcodes during a sweep, so it is thrown and reported by main rather
+ * than asserted. Asserts remain for broken invariants of the translators.
+ */
+class TranslationError : public std::runtime_error {
+public:
+    enum Category {
+        Lifter,   // the lifter itself failed on the opcode
+        Variable, // a lifter register or state field with no unified register
+        State,    // an unsupported use of lifter state or a unified register
+        Memory,   // an unsupported memory access
+        Input,    // input which is not the expected lifter output
+    };
+
+    TranslationError(Category category, const std::string& what)
+        : std::runtime_error{what}, category{category} {}
+
+    const char* categoryName() const {
+        switch (category) {
+            case Lifter: return "lifter";
+            case Variable: return "variable";
+            case State: return "state";
+            case Memory: return "memory";
+            case Input: return "input";
+        }
+        return "unknown";
+    }
+
+    const Category category;
+};
+
+// exit status of llvm-translator after a TranslationError.
+constexpr int TRANSLATION_ERROR_EXIT = 2;
+
+// throws a TranslationError with the offending value appended to the message.
+[[noreturn]] inline void unsupported(TranslationError::Category category, const std::string& what,
+        const Value* v = nullptr) {
+    std::string msg{what};
+    if (v) {
+        raw_string_ostream os{msg};
+        os << ": " << *v;
+    }
+    throw TranslationError{category, msg};
+}
@@ -1,117 +1,432 @@
 #include <cstdlib>
 #include <ranges>
 #include <map>
+#include <set>
 #include <iostream>
 #include <fstream>
+#include <optional>
+#include <sstream>
 
 
 #include "llvm/IR/Module.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Verifier.h"
 #include "llvm/IRReader/IRReader.h"
+#include "llvm/Passes/PassBuilder.h"
 
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/SourceMgr.h"
+#include "llvm/Transforms/Utils/Cloning.h"
 
 
+#include "api.h"
+#include "archive.h"
+#include "canonical.h"
 #include "context.h"
+#include "error.h"
+#include "metrics.h"
 #include "state.h"
-#include "translate.h"
 
 using namespace llvm;
 
-const char *__asan_default_options() {
-    return "disable_coredump=0";
+void report(const std::string& where, const TranslationError& e) {
+    errs() << where << ": " << e.categoryName() << " error: " << e.what() << '\n';
 }
 
+/**
+ * Unifies the globals of each module. Modules which cannot be parsed or
+ * corrected are skipped, so the other lifters can still be compared, and
+ * the exit status is then TRANSLATION_ERROR_EXIT.
+ */
 int force_vars(std::vector<std::string>& argv) {
-    std::map<std::string, Type*> globals;
-    std::map<std::string, Type*> loads;
     std::map<std::string, std::unique_ptr<Module>> Modules;
+    std::map<std::string, Module*> parsed;
+    bool skipped = false;
 
     auto fnames = std::ranges::subrange(argv.begin() + 2, argv.end());
 
     for (auto& fname : fnames) {
         SMDiagnostic Err{};
-        auto Module = parseIRFile(fname, Err, Context);
-        assert(Module && "failed to parse module");
+        auto Module = parseInput(fname, Err);
+        if (!Module) {
+            Err.print(argv[0].c_str(), errs());
+            errs() << "skipping " << fname << '\n';
+            skipped = true;
+            continue;
+        }
+        parsed[fname] = Module.get();
         Modules[fname] = std::move(Module);
     }
 
-    for (auto& [_, Module] : Modules) {
-        for (auto& var : Module->getGlobalList()) {
-            if (var.hasNUsesOrMore(1)) {
-                std::string name{var.getName()};
-                globals[name] = var.getValueType();
-            }
+    for (auto& [fname, diag] : unify(parsed)) {
+        if (!diag.ok()) {
+            diag.print(errs(), fname);
+            errs() << "skipping " << fname << '\n';
+            skipped = true;
+            continue;
         }
 
-        for (auto& fn : Module->getFunctionList()) {
-            if (fn.getName().startswith("load_") && fn.hasNUsesOrMore(1)) {
-                std::string name{fn.getName()};
-                loads[name] = fn.getReturnType();
-            }
+        bool ok = writeOutput(fname, *Modules.at(fname));
+        assert(ok && "failed to write module");
+    }
+
+    return skipped ? TRANSLATION_ERROR_EXIT : 0;
+}
+
+
+
+/**
+ * Splits each module into one slice per written register, where only that
+ * register's final value (and the memory effects) are observable, and one
+ * slice where only the memory effects are observable. Slices of the same
+ * register from different lifters can be verified as independent queries.
+ *
+ * Slices are written to OUTDIR/<file>.<register>.ll and the slice names are
+ * printed to stdout.
+ */
+int slice(std::vector<std::string>& argv) {
+    if (argv.size() < 4) {
+        errs() << "usage: " << argv[0] << " slice OUTDIR FILE...\n";
+        return 1;
+    }
+    std::string outdir = argv[2];
+    std::map<std::string, std::unique_ptr<Module>> Modules;
+
+    auto fnames = std::ranges::subrange(argv.begin() + 3, argv.end());
+    for (auto& fname : fnames) {
+        SMDiagnostic Err{};
+        auto Module = parseInput(fname, Err);
+        if (!Module) {
+            Err.print(argv[0].c_str(), errs());
+            return 1;
+        }
+        Modules[fname] = std::move(Module);
+    }
+
+    // all modules must agree on whether store_N calls can be dropped.
+    std::set<std::string> written;
+    bool keepStores = false;
+    for (auto& [fname, Module] : Modules) {
+        auto* root = findFunction(*Module, entry_function_name);
+        if (!root) {
+            errs() << "no " << entry_function_name << " function in " << fname << '\n';
+            return 1;
+        }
+        // registers of a template are stored to through its register file,
+        // which writtenGlobals does not see.
+        if (root->arg_size() > 0) {
+            errs() << "slice does not support templates: " << fname << '\n';
+            return 1;
         }
+        written.merge(writtenGlobals(*root));
+        keepStores |= loadsAfterStores(*root);
     }
 
+    const std::string memory = "mem";
+    std::vector<std::string> slices{written.begin(), written.end()};
+    slices.push_back(memory);
+
     for (auto& [fname, Module] : Modules) {
-        auto* root = findFunction(*Module, "root");
-        
-        if (root) {
-            auto* entry = &root->getEntryBlock();
-
-            if (entry->getName() != "forced_vars") {
-                auto* entry2 = BasicBlock::Create(Context, "forced_vars", root, entry);
-
-                IRBuilder irb{entry2, entry2->begin()};
-                for (auto& [nm, ty] : globals) {
-                    auto* glo = Module->getNamedGlobal(nm);
-                    auto* load = irb.CreateLoad(ty, glo, "_" + nm);
-                    noundef(load);
+        std::string base = fname.substr(fname.find_last_of('/') + 1);
+        if (base.ends_with(".ll"))
+            base.resize(base.size() - 3);
+        for (auto& nm : slices) {
+            auto Slice = CloneModule(*Module);
+            auto* root = findFunction(*Slice, entry_function_name);
+
+            for (auto& other : writtenGlobals(*root)) {
+                if (other != nm)
+                    internaliseGlobal(*root, Slice->getNamedGlobal(other));
+            }
+
+            if (nm != memory && !keepStores) {
+                for (auto& bb : *root) for (auto& inst : make_early_inc_range(bb)) {
+                    auto* call = dyn_cast<CallInst>(&inst);
+                    Function* fn = call ? call->getCalledFunction() : nullptr;
+                    if (fn && fn->getName().startswith("store_"))
+                        call->eraseFromParent();
                 }
-                irb.CreateBr(entry);
             }
+
+            if (verifyModule(*Slice, &errs())) {
+                errs() << "slice " << nm << " of " << fname << " failed to verify\n";
+                return 1;
+            }
+
+            std::error_code Err;
+            raw_fd_ostream file{outdir + "/" + base + "." + nm + ".ll", Err};
+            if (Err) {
+                errs() << "failed to write slice: " << Err.message() << '\n';
+                return 1;
+            }
+            file << *Slice;
+        }
+    }
+
+    for (auto& nm : slices) {
+        outs() << nm << '\n';
+    }
+    return 0;
+}
+
+/**
+ * Looks up a named pass pipeline in the presets file ($PASS_PRESETS, or
+ * tools/presets.txt of the source tree it was built from, lines of
+ * "name pipeline"). Returns nullopt if there is no such preset.
+ */
+std::optional<std::string> passPreset(const std::string& name) {
+    const char* fname = getenv("PASS_PRESETS");
+    std::ifstream file{fname ? fname : PASS_PRESETS_FILE};
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream words{line};
+        std::string key, pipeline;
+        if (words >> key >> pipeline && key == name)
+            return pipeline;
+    }
+    return std::nullopt;
+}
+
+/**
+ * Runs a pass pipeline over the module, like post.sh. PIPELINE is either a
+ * preset name or a pipeline in opt's -passes syntax.
+ */
+int optimise(std::vector<std::string>& argv) {
+    if (argv.size() < 3) {
+        errs() << "usage: " << argv[0] << " opt PIPELINE [FILE]\n";
+        return 1;
+    }
+    std::string pipeline = passPreset(argv[2]).value_or(argv[2]);
+    std::string fname = argv.size() >= 4 ? argv[3] : "/dev/stdin";
+
+    SMDiagnostic Err{};
+    auto Module = parseInput(fname, Err);
+    if (!Module) {
+        Err.print(argv[0].c_str(), errs());
+        return 1;
+    }
+
+    LoopAnalysisManager LAM;
+    FunctionAnalysisManager FAM;
+    CGSCCAnalysisManager CGAM;
+    ModuleAnalysisManager MAM;
+
+    PassBuilder PB;
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+    ModulePassManager MPM;
+    if (auto E = PB.parsePassPipeline(MPM, pipeline)) {
+        errs() << "invalid pipeline '" << pipeline << "': " << toString(std::move(E)) << '\n';
+        return 1;
+    }
+    MPM.run(*Module, MAM);
+
+    outs() << *Module;
+    return 0;
+}
+
+int stats(std::vector<std::string>& argv) {
+    if (argv.size() != 4) {
+        errs() << "usage: " << argv[0] << " stats STAGE FILE\n";
+        return 1;
+    }
+    auto& stage = argv[2];
+    auto& fname = argv[3];
+
+    SMDiagnostic Err{};
+    auto Module = parseInput(fname, Err);
+    if (!Module) {
+        Err.print(argv[0].c_str(), errs());
+        return 1;
+    }
+
+    auto* root = findFunction(*Module, entry_function_name);
+    if (!root) {
+        errs() << "no " << entry_function_name << " function in " << fname << '\n';
+        return 1;
+    }
+
+    outs() << "metrics " << stage << ' ' << computeMetrics(*root) << '\n';
+    return 0;
+}
+
+/**
+ * Generalises modules lifted from one instance of an encoding over its
+ * register fields (see templateRegisters). FIELDS is e.g. "Rd=1,Rn=2",
+ * giving the register each field selects in this instance. OTHER is a
+ * translated module of another instance, whose fields select none of these
+ * registers, so the registers it shares with this one are implicit. Files
+ * are only rewritten if every one can be templated, so their signatures agree.
+ */
+int templates(std::vector<std::string>& argv) {
+    if (argv.size() < 5) {
+        errs() << "usage: " << argv[0] << " template FIELDS OTHER FILE...\n";
+        return 1;
+    }
+
+    std::map<std::string, unsigned> fields{};
+    std::stringstream ss{argv[2]};
+    for (std::string pair; std::getline(ss, pair, ',');) {
+        auto eq = pair.find('=');
+        if (eq == std::string::npos) {
+            errs() << "expected FIELD=NUMBER, got " << pair << '\n';
+            return 1;
         }
+        fields[pair.substr(0, eq)] = std::stoul(pair.substr(eq + 1));
+    }
 
-        std::vector<GlobalVariable*> globals; 
-        for (auto& glo : Module->getGlobalList()) {
-            globals.push_back(&glo);
+    SMDiagnostic OtherErr{};
+    auto Other = parseInput(argv[3], OtherErr);
+    if (!Other) {
+        OtherErr.print(argv[0].c_str(), errs());
+        return 1;
+    }
+    std::set<unsigned> implicit{};
+    for (StateType type : {X, V}) {
+        for (int i = 0; i < 32; i++) {
+            auto* glo = Other->getNamedGlobal(StateReg{type, {i}}.name());
+            if (glo && !glo->use_empty())
+                implicit.insert(i);
         }
-        correctGlobalAccesses(globals);
+    }
 
+    std::map<std::string, std::unique_ptr<Module>> Modules;
+    for (auto& fname : std::ranges::subrange(argv.begin() + 4, argv.end())) {
+        SMDiagnostic Err{};
+        auto Module = parseInput(fname, Err);
+        if (!Module) {
+            Err.print(argv[0].c_str(), errs());
+            return 1;
+        }
+        try {
+            templateRegisters(*Module, fields, implicit);
+        } catch (const TranslationError& e) {
+            report(fname, e);
+            return TRANSLATION_ERROR_EXIT;
+        }
         bool err = verifyModule(*Module, &errs());
-        assert(!err && "verify module failed");
-
-        std::error_code Err; 
-        llvm::raw_fd_ostream file{fname, Err};
-        file << *Module;
+        assert(!err && "verify template failed");
+        Modules[fname] = std::move(Module);
     }
 
+    for (auto& [fname, Module] : Modules) {
+        bool ok = writeOutput(fname, *Module);
+        assert(ok && "failed to write module");
+    }
     return 0;
 }
 
+/**
+ * Compares the root functions of two modules up to value names and operand
+ * order (see canonical.h). Exits with 0 if they are identical, so the
+ * solver need not be run, and 1 otherwise.
+ */
+int same(std::vector<std::string>& argv) {
+    if (argv.size() != 4) {
+        errs() << "usage: " << argv[0] << " same FILE FILE\n";
+        return 1;
+    }
 
+    std::vector<std::unique_ptr<Module>> modules{};
+    std::vector<Function*> roots{};
+    for (auto& fname : std::ranges::subrange(argv.begin() + 2, argv.end())) {
+        SMDiagnostic Err{};
+        auto& Module = modules.emplace_back(parseInput(fname, Err));
+        if (!Module) {
+            Err.print(argv[0].c_str(), errs());
+            return 1;
+        }
+        auto* root = findFunction(*Module, entry_function_name);
+        if (!root) {
+            errs() << "no " << entry_function_name << " function in " << fname << '\n';
+            return 1;
+        }
+        roots.push_back(root);
+    }
 
-int main(int argc, char** argv)
+    bool equal = structurallyEqual(*roots[0], *roots[1]);
+    outs() << (equal ? "identical" : "different") << '\n';
+    return equal ? 0 : 1;
+}
+
+
+/**
+ * Manages archives of lifter outputs and modules (see archive.h).
+ *   ar add ARCHIVE FILE...     stores each file, keyed by its base name
+ *   ar put ARCHIVE KEY [FILE]  stores the file (or stdin) under KEY
+ *   ar get ARCHIVE KEY         writes the data under KEY to stdout
+ *   ar list ARCHIVE            lists keys
+ */
+int archive(std::vector<std::string>& argv) {
+    std::string cmd = argv.size() >= 3 ? argv[2] : "";
+    auto usage = [&]() {
+        errs() << "usage: " << argv[0] << " ar add|put|get|list ARCHIVE ...\n";
+        return 1;
+    };
+    if (argv.size() < 4)
+        return usage();
+    Archive archive{argv[3]};
+
+    auto store = [&](const std::string& key, const std::string& fname) {
+        auto buf = MemoryBuffer::getFileOrSTDIN(fname);
+        if (!buf || !archive.put(key, (*buf)->getBuffer())) {
+            errs() << "failed to store " << fname << " in " << archive.path() << '\n';
+            return false;
+        }
+        return true;
+    };
+
+    if (cmd == "add") {
+        for (auto& fname : std::ranges::subrange(argv.begin() + 4, argv.end())) {
+            if (!store(fname.substr(fname.find_last_of('/') + 1), fname))
+                return 1;
+        }
+    } else if (cmd == "put" && argv.size() >= 5) {
+        return store(argv[4], argv.size() >= 6 ? argv[5] : "-") ? 0 : 1;
+    } else if (cmd == "get" && argv.size() == 5) {
+        auto buf = archive.get(argv[4]);
+        if (!buf)
+            return 1;
+        outs() << buf->getBuffer();
+    } else if (cmd == "list") {
+        for (auto& key : archive.keys())
+            outs() << key << '\n';
+    } else {
+        return usage();
+    }
+    return 0;
+}
+
+
+int run(int argc, char** argv)
 {
     std::vector<std::string> args{argv, argv + argc};
 
     std::string lifter {argc >= 2 ? argv[1] : ""};
     const char* fname = argc >= 3 ? argv[2] : "/dev/stdin";
 
-    Context.enableOpaquePointers(); // llvm 14 specific
-
-    std::function<void(Module&)> translator{};
-
-    if (lifter == "cap") {
-        translator = capstone;
-    } else if (lifter == "rem") {
-        translator = remill;
-    } else if (lifter == "asl") {
-        translator = asl;
-    } else if (lifter == "vars") {
+    if (lifter == "vars") {
         return force_vars(args);
-    } else {
+    } else if (lifter == "slice") {
+        return slice(args);
+    } else if (lifter == "opt") {
+        return optimise(args);
+    } else if (lifter == "ar") {
+        return archive(args);
+    } else if (lifter == "template") {
+        return templates(args);
+    } else if (lifter == "same") {
+        return same(args);
+    } else if (lifter == "stats") {
+        return stats(args);
+    }
+
+    auto translator = parseLifter(lifter);
+    if (!translator) {
         errs() << "unsupported lifter, expected cap or rem or asl.\n";
         return 1;
     }
@@ -119,7 +434,7 @@ int main(int argc, char** argv)
 
     SMDiagnostic Err{};
     errs() << "loading IR file " << fname << '\n';
-    std::unique_ptr<Module> ModPtr = parseIRFile(fname, Err, Context);
+    std::unique_ptr<Module> ModPtr = parseInput(fname, Err);
     if (!ModPtr) {
         Err.print(argv[0], errs());
         return 1;
@@ -130,15 +445,29 @@ int main(int argc, char** argv)
     auto& funcs = Mod.getFunctionList();
     assert(funcs.size() >= 1);
 
-    assert(translator);
-    translator(Mod);
+    auto diag = translate(Mod, *translator);
+    if (diag.category) {
+        diag.print(errs(), fname);
+        return TRANSLATION_ERROR_EXIT;
+    }
 
     outs() << Mod;
 
-    bool err = verifyModule(Mod, &errs());
-    if (err) {
-        errs() << "\n### MODULE VERIFY FAILED ###\n";
+    if (!diag.verifier.empty()) {
+        errs() << diag.verifier << "\n### MODULE VERIFY FAILED ###\n";
         return -1;
     }
     return 0;
 }
+
+int main(int argc, char** argv)
+{
+    // unsupported input is reported with a distinct status, rather than
+    // aborting (and dumping core) on an assert.
+    try {
+        return run(argc, argv);
+    } catch (const TranslationError& e) {
+        report(argc >= 3 ? argv[2] : "/dev/stdin", e);
+        return TRANSLATION_ERROR_EXIT;
+    }
+}
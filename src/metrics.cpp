@@ -0,0 +1,55 @@
+#include "metrics.h"
+
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/Instructions.h"
+
+#include <set>
+
+using namespace llvm;
+
+static unsigned intWidth(Type* ty) {
+    return ty->isIntegerTy() ? ty->getIntegerBitWidth() : 0;
+}
+
+IRMetrics computeMetrics(Function& root) {
+    IRMetrics metrics{};
+    std::set<GlobalVariable*> globals{};
+
+    for (BasicBlock& bb : root) {
+        metrics.blocks++;
+        for (Instruction& inst : bb) {
+            metrics.instructions++;
+            metrics.opcodes[inst.getOpcodeName()]++;
+
+            metrics.maxIntWidth = std::max(metrics.maxIntWidth, intWidth(inst.getType()));
+            for (Value* op : inst.operands()) {
+                metrics.maxIntWidth = std::max(metrics.maxIntWidth, intWidth(op->getType()));
+                if (auto* glo = dyn_cast<GlobalVariable>(op))
+                    globals.insert(glo);
+            }
+
+            if (auto* call = dyn_cast<CallInst>(&inst)) {
+                Function* fn = call->getCalledFunction();
+                if (fn && fn->getName().startswith("load_"))
+                    metrics.loadCalls++;
+                else if (fn && fn->getName().startswith("store_"))
+                    metrics.storeCalls++;
+            }
+        }
+    }
+    metrics.globals = globals.size();
+    return metrics;
+}
+
+raw_ostream& operator<<(raw_ostream& os, const IRMetrics& metrics) {
+    os << "insts=" << metrics.instructions
+        << " blocks=" << metrics.blocks
+        << " maxwidth=" << metrics.maxIntWidth
+        << " loads=" << metrics.loadCalls
+        << " stores=" << metrics.storeCalls
+        << " globals=" << metrics.globals;
+    for (auto& [op, n] : metrics.opcodes) {
+        os << " op." << op << '=' << n;
+    }
+    return os;
+}
@@ -0,0 +1,28 @@
+#pragma once 
+
+#include <map>
+#include <string>
+
+#include "llvm/IR/Function.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+/**
+ * Structural measures of a translated root function, which are used to
+ * predict (and catch regressions in) the cost of verifying it.
+ */
+struct IRMetrics {
+    size_t instructions = 0;
+    size_t blocks = 0;
+    unsigned maxIntWidth = 0;
+    size_t loadCalls = 0; // calls to load_N
+    size_t storeCalls = 0; // calls to store_N
+    size_t globals = 0; // distinct globals referenced
+    std::map<std::string, size_t> opcodes;
+};
+
+IRMetrics computeMetrics(Function& root);
+
+// prints metrics as space-separated key=value pairs on one line.
+raw_ostream& operator<<(raw_ostream& os, const IRMetrics& metrics);
@@ -1,13 +1,16 @@
 #include "context.h"
+#include "error.h"
 #include "state.h"
 
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/Attributes.h>
+#include <llvm/IR/InstIterator.h>
 #include <llvm/Transforms/Utils/UnifyFunctionExitNodes.h>
 #include <optional>
 #include <string>
 #include <span>
 #include <algorithm>
+#include <set>
 
 StateReg translateStateAccess(Module& m, GetElementPtrInst& gep) {
   std::vector<int> indices;
@@ -58,8 +61,7 @@ StateReg translateStateAccess(Module& m, GetElementPtrInst& gep) {
     return StateReg{V, k};
   }
 
-  errs() << "failed: " << gep << '\n';
-  assert(false && "unhandled state getelementptr");
+  unsupported(TranslationError::Variable, "unhandled state getelementptr", &gep);
 }
 
 
@@ -115,8 +117,7 @@ void replaceRemillStateAccess(Module& m, Function& f) {
           continue;
         }
       }
-      errs() << *u << '\n';
-      assert(false && "unsupported user of remill state");
+      unsupported(TranslationError::State, "unsupported user of remill state", u);
     }
   }
 
@@ -151,7 +152,8 @@ void replaceRemillStateAccess(Module& m, Function& f) {
 }
 
 void replaceRemillTailCall(Module& m, Function& f) {
-  assert(!findFunction(m, "__remill_error") && "opcode unsupported in remill");
+  if (findFunction(m, "__remill_error"))
+    unsupported(TranslationError::Lifter, "opcode unsupported in remill");
   Function* missing_block = findFunction(m, "__remill_missing_block");
   if (!missing_block) {
     missing_block = findFunction(m, "__remill_error");
@@ -162,7 +164,8 @@ void replaceRemillTailCall(Module& m, Function& f) {
   if (!missing_block) {
     missing_block = findFunction(m, "__remill_jump"); // br
   }
-  assert(missing_block);
+  if (!missing_block)
+    unsupported(TranslationError::Input, "remill output has no block exit intrinsic");
 
   // ReturnInst::Create(Context, UndefValue::get(PointerType::get(Context, 0)), 
   //   BasicBlock::Create(Context, "", &missing_block));
@@ -243,9 +246,75 @@ Function* replaceRemillFunctionSignature(Module& m, Function& f) {
   return f2;
 }
 
+// remill's output carries its whole semantics library. deletes every function
+// and global not reachable from f or the __remill_* intrinsics looked up
+// below, so that later passes (and post.sh's inlining) only see what the
+// opcode uses.
+void pruneRemillLibrary(Module& m, Function& f) {
+  std::set<GlobalValue*> live{};
+  std::vector<GlobalValue*> worklist{&f};
+  for (auto& fn : m.functions()) {
+    if (fn.getName().startswith("__remill_"))
+      worklist.push_back(&fn);
+  }
+
+  std::set<Constant*> seen{};
+  auto visit = [&](Value* v, auto& visit) -> void {
+    if (auto* gv = dyn_cast<GlobalValue>(v)) {
+      worklist.push_back(gv);
+    } else if (auto* c = dyn_cast<Constant>(v)) {
+      if (seen.insert(c).second)
+        for (Value* op : c->operands())
+          visit(op, visit);
+    }
+  };
+
+  while (!worklist.empty()) {
+    GlobalValue* gv = worklist.back();
+    worklist.pop_back();
+    if (!live.insert(gv).second)
+      continue;
+
+    if (auto* fn = dyn_cast<Function>(gv)) {
+      for (auto& inst : instructions(fn))
+        for (Value* op : inst.operands())
+          visit(op, visit);
+    } else if (auto* glo = dyn_cast<GlobalVariable>(gv)) {
+      if (glo->hasInitializer())
+        visit(glo->getInitializer(), visit);
+    } else if (auto* alias = dyn_cast<GlobalAlias>(gv)) {
+      visit(alias->getAliasee(), visit);
+    }
+  }
+
+  // references between dead values are dropped before any is erased.
+  std::vector<GlobalValue*> dead{};
+  for (auto& gv : m.global_values()) {
+    if (!live.contains(&gv))
+      dead.push_back(&gv);
+  }
+  for (auto* gv : dead) {
+    if (auto* fn = dyn_cast<Function>(gv))
+      fn->dropAllReferences();
+    else if (auto* glo = dyn_cast<GlobalVariable>(gv))
+      glo->setInitializer(nullptr);
+    else if (auto* alias = dyn_cast<GlobalAlias>(gv))
+      alias->setAliasee(UndefValue::get(alias->getType()));
+  }
+  for (auto* gv : dead) {
+    gv->removeDeadConstantUsers();
+    gv->eraseFromParent();
+  }
+}
+
 void remill(Module& m) {
   m.setTargetTriple("");
 
+  Function* root = findFunction(m, "sub_0");
+  if (!root)
+    unsupported(TranslationError::Input, "remill missing sub_0");
+  pruneRemillLibrary(m, *root);
+
   std::vector<std::string> flag_funcs = {
     "__remill_flag_computation_sign",
     "__remill_flag_computation_zero",
@@ -282,9 +351,6 @@ void remill(Module& m) {
     f.addFnAttr(Attribute::get(Context, Attribute::AttrKind::AlwaysInline));
   }
 
-  Function* root = findFunction(m, "sub_0");
-  assert(root && "remill missing sub_0");
-  
   auto globals = generateGlobalState(m, *root);
 
   replaceRemillTailCall(m, *root);
@@ -293,6 +359,7 @@ void remill(Module& m) {
 
   correctMemoryAccesses(m, *root);
   correctGlobalAccesses(globals);
+  pruneGlobalState(globals);
 
   root = replaceRemillFunctionSignature(m, *root);
 }
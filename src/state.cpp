@@ -1,11 +1,17 @@
 #include "state.h"
 #include "context.h"
+#include "error.h"
 
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/Support/Casting.h"
 
+#include <algorithm>
+#include <cstdlib>
 #include <map>
+#include <optional>
+#include <set>
+#include <span>
 
 using namespace llvm;
 
@@ -73,45 +79,363 @@ std::vector<GlobalVariable*> generateGlobalState(Module& m, Function& f) {
     return globals;
 }
 
+void pruneGlobalState(std::vector<GlobalVariable*>& globals) {
+    std::vector<GlobalVariable*> live{};
+    for (auto* glo : globals) {
+        for (User* u : clone_it(glo->users())) {
+            if (auto* load = dyn_cast<LoadInst>(u); load && load->use_empty() && !load->isVolatile()) {
+                load->eraseFromParent();
+            }
+        }
+
+        if (glo->use_empty()) {
+            glo->eraseFromParent();
+        } else {
+            live.push_back(glo);
+        }
+    }
+    globals = live;
+}
+
+/**
+ * A value of width `width` extracted from bit `offset` of a global register.
+ */
+struct Extract {
+    Instruction* inst;
+    unsigned offset;
+    unsigned width;
+};
+
+/**
+ * Decomposes a load of a global into the bit ranges which are actually used,
+ * or nullopt if the whole loaded value escapes.
+ * Recognises trunc(load) and trunc(lshr(load, c)), as produced by
+ * correctGlobalAccesses and left by instcombine.
+ */
+static std::optional<std::vector<Extract>> loadExtracts(LoadInst* load, unsigned gloWd) {
+    unsigned loadWd = load->getType()->getPrimitiveSizeInBits();
+    if (loadWd < gloWd) {
+        return std::vector<Extract>{{load, 0, loadWd}};
+    }
+
+    std::vector<Extract> extracts{};
+    for (User* u : load->users()) {
+        if (auto* trunc = dyn_cast<TruncInst>(u)) {
+            extracts.push_back({trunc, 0, trunc->getType()->getIntegerBitWidth()});
+            continue;
+        }
+
+        auto* shr = dyn_cast<BinaryOperator>(u);
+        ConstantInt* amount = shr ? dyn_cast<ConstantInt>(shr->getOperand(1)) : nullptr;
+        if (!shr || shr->getOpcode() != Instruction::LShr || shr->getOperand(0) != load || !amount)
+            return std::nullopt;
+
+        for (User* u2 : shr->users()) {
+            auto* trunc = dyn_cast<TruncInst>(u2);
+            if (!trunc)
+                return std::nullopt;
+            unsigned offset = amount->getZExtValue();
+            unsigned width = trunc->getType()->getIntegerBitWidth();
+            if (offset + width > gloWd)
+                return std::nullopt;
+            extracts.push_back({trunc, offset, width});
+        }
+    }
+    return extracts;
+}
+
+std::map<std::string, BitRange> liveGlobalBits(Module& m) {
+    std::map<std::string, BitRange> live{};
+    for (auto& glo : m.globals()) {
+        if (!glo.getValueType()->isIntegerTy() || glo.use_empty())
+            continue;
+
+        unsigned gloWd = glo.getValueType()->getIntegerBitWidth();
+        BitRange full{0, gloWd};
+        BitRange range{gloWd, 0};
+        for (User* u : glo.users()) {
+            auto* load = dyn_cast<LoadInst>(u);
+            auto extracts = load ? loadExtracts(load, gloWd) : std::nullopt;
+            if (!extracts.has_value()) {
+                // stored to, or read in full.
+                range = full;
+                break;
+            }
+            for (auto& e : *extracts) {
+                range.lo = std::min(range.lo, e.offset);
+                range.hi = std::max(range.hi, e.offset + e.width);
+            }
+        }
+        live[glo.getName().str()] = range;
+    }
+    return live;
+}
+
+GlobalVariable* narrowGlobal(Module& m, GlobalVariable* glo, BitRange range) {
+    assert(range.lo < range.hi && "cannot narrow global to an empty range");
+    GlobalVariable* narrow = variable(m, range.hi - range.lo, "");
+    narrow->takeName(glo);
+
+    unsigned gloWd = glo->getValueType()->getIntegerBitWidth();
+    for (User* u : clone_it(glo->users())) {
+        auto* load = cast<LoadInst>(u);
+        auto extracts = loadExtracts(load, gloWd);
+        assert(extracts.has_value() && "narrowed global is used outside of its live range");
+
+        IRBuilder irb{load};
+        auto* load2 = irb.CreateLoad(narrow->getValueType(), narrow);
+        if (load->hasMetadata("noundef"))
+            noundef(load2);
+
+        for (auto& e : *extracts) {
+            assert(range.lo <= e.offset && e.offset + e.width <= range.hi);
+            IRBuilder irb{e.inst};
+            unsigned shift = e.offset - range.lo;
+            Value* val = shift > 0 ? irb.CreateLShr(load2, shift) : load2;
+            val = irb.CreateTruncOrBitCast(val, e.inst->getType());
+            e.inst->replaceAllUsesWith(val);
+            if (e.inst != load)
+                e.inst->eraseFromParent();
+        }
+
+        for (User* u2 : clone_it(load->users())) {
+            // now-dead lshr between the load and its truncs.
+            assert(u2->use_empty());
+            cast<Instruction>(u2)->eraseFromParent();
+        }
+        load2->takeName(load);
+        load->eraseFromParent();
+    }
+
+    // the register bits held by the narrowed global, see templateRegisters.
+    auto* i32 = Type::getInt32Ty(Context);
+    narrow->setMetadata("narrowed", MDNode::get(Context, {ConstantAsMetadata::get(ConstantInt::get(i32, range.lo))}));
+
+    glo->eraseFromParent();
+    return narrow;
+}
+
+void templateRegisters(Module& m, const std::map<std::string, unsigned>& fields, const std::set<unsigned>& implicit) {
+    Function* old = findFunction(m, entry_function_name);
+    if (!old)
+        unsupported(TranslationError::Input, "template requires translated root function");
+    if (old->arg_size() > 0)
+        unsupported(TranslationError::Input, "root function is already a template");
+
+    // fields selecting the same register alias, and share a parameter.
+    std::map<unsigned, std::vector<std::string>> byNumber{};
+    for (auto& [field, num] : fields) {
+        if (num >= 31)
+            unsupported(TranslationError::Input, "template fields must select registers below 31");
+        if (implicit.contains(num))
+            unsupported(TranslationError::Input, "template field " + field + " selects register "
+                + std::to_string(num) + ", which the instruction also uses implicitly");
+        byNumber[num].push_back(field);
+    }
+
+    // root takes one i5 register number per register selected by fields.
+    auto* idxTy = Type::getIntNTy(Context, 5);
+    std::vector<Type*> params(byNumber.size(), idxTy);
+    Function* root = Function::Create(FunctionType::get(old->getReturnType(), params, false),
+        old->getLinkage(), "", m);
+    root->copyAttributesFrom(old);
+    root->getBasicBlockList().splice(root->end(), old->getBasicBlockList());
+    root->takeName(old);
+    old->eraseFromParent();
+
+    std::map<unsigned, Value*> args{};
+    auto arg = root->arg_begin();
+    for (auto& [num, names] : byNumber) {
+        std::string name = names[0];
+        for (size_t i = 1; i < names.size(); i++)
+            name += "_" + names[i];
+        arg->setName(name);
+        args[num] = &*arg++;
+    }
+
+    IRBuilder irb{&*root->getEntryBlock().getFirstInsertionPt()};
+    std::set<unsigned> used{};
+    for (StateType type : {X, V}) {
+        std::vector<std::pair<unsigned, GlobalVariable*>> regs{};
+        for (unsigned i = 0; i < 32; i++) {
+            if (auto* glo = m.getNamedGlobal(StateReg{type, {(int)i}}.name()))
+                regs.emplace_back(i, glo);
+        }
+        if (regs.empty())
+            continue;
+
+        auto* fileTy = ArrayType::get(StateReg{type, {0}}.ty(), 32);
+        auto* file = new GlobalVariable(m, fileTy, false, GlobalValue::ExternalLinkage,
+            Constant::getNullValue(fileTy), StateReg{type, {0}}.name().substr(0, 1));
+
+        std::vector<Value*> fixed{ConstantInt::get(idxTy, 31)};
+        std::vector<Value*> symbolic{};
+        for (auto& [num, glo] : regs) {
+            Value* idx = ConstantInt::get(idxTy, num);
+            if (byNumber.contains(num)) {
+                idx = args.at(num);
+                used.insert(num);
+                symbolic.push_back(idx);
+            } else {
+                fixed.push_back(idx);
+            }
+            Value* ptr = irb.CreateInBoundsGEP(fileTy, file, {irb.getInt64(0), irb.CreateZExt(idx, irb.getInt64Ty())});
+
+            unsigned lo = 0;
+            if (auto* md = glo->getMetadata("narrowed"))
+                lo = mdconst::extract<ConstantInt>(md->getOperand(0))->getZExtValue();
+            if (lo % 8 != 0)
+                unsupported(TranslationError::State, "register narrowed to a bit offset cannot be templated", glo);
+            if (lo > 0)
+                ptr = irb.CreateConstInBoundsGEP1_64(irb.getInt8Ty(), ptr, lo / 8);
+
+            glo->replaceAllUsesWith(ptr);
+            glo->eraseFromParent();
+        }
+
+        // instances are only equivalent to the template when the field
+        // registers do not alias each other, other registers, or SP/ZR.
+        for (size_t i = 0; i < symbolic.size(); i++) {
+            std::vector<Value*> others{fixed};
+            others.insert(others.end(), symbolic.begin() + i + 1, symbolic.end());
+            for (Value* other : others)
+                irb.CreateAssumption(irb.CreateICmpNE(symbolic[i], other));
+        }
+    }
+
+    for (auto& [field, num] : fields) {
+        if (!used.contains(num))
+            unsupported(TranslationError::Input, "template field " + field + " selects no register");
+    }
+}
+
 void noundef(LoadInst* load) {
     assert(load);
     load->setMetadata("noundef", MDTuple::get(Context, {}));
 }
 
-void correctGetElementPtr(GlobalVariable* glo, User* gep, int offset) {
+/**
+ * Whether inst may read or write the given global register, other than
+ * through a lane getelementptr.
+ * Other globals and allocas never alias the unified state, and neither do the
+ * inaccessible-memory load_N/store_N functions.
+ */
+static bool mayAccessGlobal(Instruction& inst, GlobalVariable* glo) {
+    if (!inst.mayReadOrWriteMemory())
+        return false;
+    if (Value* ptr = getLoadStorePointerOperand(&inst)) {
+        Value* base = ptr->stripInBoundsConstantOffsets();
+        if (auto* other = dyn_cast<GlobalVariable>(base))
+            return other == glo;
+        return !isa<AllocaInst>(base);
+    }
+    if (auto* call = dyn_cast<CallBase>(&inst))
+        return !call->onlyAccessesInaccessibleMemory();
+    return true;
+}
+
+/**
+ * Rewrites loads and stores through constant getelementptrs of glo (i.e.
+ * accesses of single vector lanes) into accesses of the whole register.
+ *
+ * Within each block, a run of lane stores with no other access of glo in
+ * between becomes a single read-modify-write (with no read at all if every
+ * bit is written), and lane loads with no write in between share one load.
+ */
+void correctGetElementPtrs(GlobalVariable* glo, const std::map<User*, int>& offsets) {
     Type* gloTy = glo->getValueType();
-    
-    for (User* u2 : clone_it(gep->users())) {
-        if (auto* load = dyn_cast<LoadInst>(u2)) {
-            IRBuilder irb{load};
-            auto* load2 = irb.CreateLoad(gloTy, glo, "");
-            auto* shift = offset > 0 ? irb.CreateLShr(load2, offset) : load2;
-            auto* trunc = irb.CreateTruncOrBitCast(shift, load->getType());
-            load->replaceAllUsesWith(trunc);
-            load->eraseFromParent();
-        } else if (auto* store = dyn_cast<StoreInst>(u2)) {
-            IRBuilder irb{store};
-
-            auto* value = store->getValueOperand();
-            auto* valueTy = value->getType();
-            value = irb.CreateZExtOrBitCast(value, gloTy);
-            value = offset > 0 ? irb.CreateShl(value, offset) : value;
-
-            auto* load2 = irb.CreateLoad(gloTy, glo, "");
-            auto focus = APInt::getZero(valueTy->getIntegerBitWidth());
-            auto mask = APInt::getAllOnes(gloTy->getIntegerBitWidth());
-            mask.insertBits(focus, offset);
-
-            auto* andd = irb.CreateAnd(load2, ConstantInt::get(gloTy, mask));
-            auto* orr = irb.CreateOr(andd, value);
-            store->replaceAllUsesWith(irb.CreateStore(orr, glo));
-            store->eraseFromParent();
-        } else {
-            errs() << *u2 << '\n';
-            assert(false && "unsupported use of getelementptr of global register");
+    unsigned gloWd = gloTy->getIntegerBitWidth();
+
+    std::map<Instruction*, int> lanes{};
+    std::vector<BasicBlock*> blocks{};
+    for (auto& [gep, offset] : offsets) {
+        for (User* u2 : gep->users()) {
+            auto* load = dyn_cast<LoadInst>(u2);
+            auto* store = dyn_cast<StoreInst>(u2);
+            if (!load && !(store && store->getPointerOperand() == gep))
+                unsupported(TranslationError::State, "unsupported use of getelementptr of global register", u2);
+            auto* inst = cast<Instruction>(u2);
+            lanes[inst] = offset;
+            if (std::find(blocks.begin(), blocks.end(), inst->getParent()) == blocks.end())
+                blocks.push_back(inst->getParent());
+        }
+    }
+
+    for (BasicBlock* bb : blocks) {
+        LoadInst* wide = nullptr;
+        std::vector<std::pair<StoreInst*, int>> pending{};
+
+        auto flush = [&]() {
+            if (pending.empty())
+                return;
+            IRBuilder irb{pending.back().first};
+
+            auto written = APInt::getZero(gloWd);
+            for (auto& [store, offset] : pending) {
+                auto valWd = store->getValueOperand()->getType()->getIntegerBitWidth();
+                written.insertBits(APInt::getAllOnes(valWd), offset);
+            }
+
+            // bits of acc which may be non-zero.
+            auto dirty = ~written;
+            Value* acc = nullptr;
+            if (!written.isAllOnes()) {
+                auto* load2 = irb.CreateLoad(gloTy, glo, "");
+                acc = irb.CreateAnd(load2, ConstantInt::get(gloTy, ~written));
+            }
+
+            for (auto& [store, offset] : pending) {
+                auto* value = store->getValueOperand();
+                auto lane = APInt::getZero(gloWd);
+                lane.insertBits(APInt::getAllOnes(value->getType()->getIntegerBitWidth()), offset);
+
+                value = irb.CreateZExtOrBitCast(value, gloTy);
+                value = offset > 0 ? irb.CreateShl(value, offset) : value;
+
+                if (acc && dirty.intersects(lane))
+                    acc = irb.CreateAnd(acc, ConstantInt::get(gloTy, ~lane));
+                acc = acc ? irb.CreateOr(acc, value) : value;
+                dirty |= lane;
+            }
+
+            irb.CreateStore(acc, glo);
+            for (auto& [store, _] : pending)
+                store->eraseFromParent();
+            pending.clear();
+        };
+
+        for (Instruction& inst : make_early_inc_range(*bb)) {
+            auto lane = lanes.find(&inst);
+            if (lane == lanes.end()) {
+                if (mayAccessGlobal(inst, glo)) {
+                    flush();
+                    if (inst.mayWriteToMemory())
+                        wide = nullptr;
+                }
+                continue;
+            }
+
+            int offset = lane->second;
+            if (auto* load = dyn_cast<LoadInst>(&inst)) {
+                flush();
+                IRBuilder irb{load};
+                if (!wide)
+                    wide = irb.CreateLoad(gloTy, glo, "");
+                auto* shift = offset > 0 ? irb.CreateLShr(wide, offset) : wide;
+                auto* trunc = irb.CreateTruncOrBitCast(shift, load->getType());
+                load->replaceAllUsesWith(trunc);
+                load->eraseFromParent();
+            } else {
+                pending.push_back({cast<StoreInst>(&inst), offset});
+                wide = nullptr;
+            }
         }
+        flush();
+    }
+
+    for (auto& [gep, _] : offsets) {
+        assert(gep->getNumUses() == 0 && "uses of gep not fully eliminated");
     }
-    assert(gep->getNumUses() == 0 && "uses of gep not fully eliminated");
 }
 
 
@@ -119,6 +443,8 @@ void correctGlobalAccesses(const std::vector<GlobalVariable*>& globals) {
     for (auto* glo : globals) {
         auto* gloTy = glo->getValueType();
         auto gloWd = gloTy->getIntegerBitWidth();
+        // lane getelementptrs are rewritten together after direct accesses.
+        std::map<User*, int> lanes{};
         for (User* u : clone_it(glo->users())) {
             if (auto* load = dyn_cast<LoadInst>(u)) {
                 auto* valTy = load->getType(); 
@@ -163,27 +489,204 @@ void correctGlobalAccesses(const std::vector<GlobalVariable*>& globals) {
                     store->setOperand(0, new ZExtInst(val, gloTy, "", store));
                 }
             } else if (auto* gep = dyn_cast<GetElementPtrInst>(u)) {
-                assert(gep->getNumIndices() == 1 && "too many indices for global register getelementptr");
+                auto* index = gep->getNumIndices() == 1 ? dyn_cast<ConstantInt>(gep->idx_begin()) : nullptr;
+                if (!index)
+                    unsupported(TranslationError::State, "unsupported getelementptr of global register", gep);
                 int wd = gep->getResultElementType()->getPrimitiveSizeInBits();
-                int index = cast<ConstantInt>(gep->idx_begin())->getSExtValue();
-                correctGetElementPtr(glo, gep, wd*index);
+                lanes[gep] = wd*index->getSExtValue();
             } else if (auto* gep2 = dyn_cast<GEPOperator>(u)) {
-                assert(gep2->getNumIndices() == 1 && "too many indices for global register getelementptr");
+                auto* index = gep2->getNumIndices() == 1 ? dyn_cast<ConstantInt>(gep2->idx_begin()) : nullptr;
+                if (!index)
+                    unsupported(TranslationError::State, "unsupported getelementptr of global register", gep2);
                 int wd = gep2->getResultElementType()->getPrimitiveSizeInBits();
-                int index = cast<ConstantInt>(gep2->idx_begin())->getSExtValue();
-                correctGetElementPtr(glo, gep2, wd*index);
+                lanes[gep2] = wd*index->getSExtValue();
             } else if (auto* phi = dyn_cast<PHINode>(u)) {
                 // ignore for now
             } else {
-                errs() << *u << '\n';
-                assert(false && "unsupported use of unified global variable");
+                unsupported(TranslationError::State, "unsupported use of unified global variable", u);
             }
         }
+        correctGetElementPtrs(glo, lanes);
     }
 }
 
+/**
+ * A load or store through an inttoptr of addr, which is base + offset.
+ */
+struct MemoryAccess {
+  Instruction* inst;
+  Value* addr;
+  Value* base;
+  int64_t offset;
+  Type* ty;
+
+  bool isLoad() const { return isa<LoadInst>(inst); }
+  unsigned size() const { return ty->getIntegerBitWidth(); }
+};
+
+/**
+ * Splits an address into a base value and constant byte offset, looking
+ * through additions and subtractions of constants. base is nullptr for
+ * constant addresses.
+ */
+static std::pair<Value*, int64_t> decomposeAddress(Value* addr) {
+  int64_t offset = 0;
+  while (auto* op = dyn_cast<BinaryOperator>(addr)) {
+    auto* rhs = dyn_cast<ConstantInt>(op->getOperand(1));
+    auto* lhs = dyn_cast<ConstantInt>(op->getOperand(0));
+    if (op->getOpcode() == Instruction::Add && rhs) {
+      offset += rhs->getSExtValue();
+      addr = op->getOperand(0);
+    } else if (op->getOpcode() == Instruction::Add && lhs) {
+      offset += lhs->getSExtValue();
+      addr = op->getOperand(1);
+    } else if (op->getOpcode() == Instruction::Sub && rhs) {
+      offset -= rhs->getSExtValue();
+      addr = op->getOperand(0);
+    } else {
+      break;
+    }
+  }
+  if (auto* c = dyn_cast<ConstantInt>(addr)) {
+    return {nullptr, offset + c->getSExtValue()};
+  }
+  return {addr, offset};
+}
+
+/**
+ * Whether inst may access the memory reached through inttoptr.
+ * Globals and allocas are distinct from it.
+ */
+static bool mayAccessMemory(Instruction& inst) {
+  if (!inst.mayReadOrWriteMemory())
+    return false;
+  if (Value* ptr = getLoadStorePointerOperand(&inst)) {
+    Value* base = ptr->stripInBoundsConstantOffsets();
+    return !isa<GlobalVariable>(base) && !isa<AllocaInst>(base);
+  }
+  return true;
+}
+
+/**
+ * Replaces the given run of loads (or stores) with load_N (or store_N) calls.
+ * Contiguous, non-overlapping accesses whose total width is one of the
+ * supported sizes are merged into a single wider call, little-endian.
+ * Clears the run.
+ */
+static void coalesceAccesses(std::vector<MemoryAccess>& run,
+    std::map<int, Function*>& loads, std::map<int, Function*>& stores) {
+  if (run.empty())
+    return;
+
+  bool isLoad = run[0].isLoad();
+  auto& fns = isLoad ? loads : stores;
+
+  auto function = [&](const MemoryAccess& a, unsigned width) {
+    auto it = fns.find(width);
+    if (it == fns.end())
+      unsupported(TranslationError::Memory, "no " + std::string(isLoad ? "load" : "store")
+        + " function for " + std::to_string(width) + " bits", a.inst);
+    return it->second;
+  };
+
+  auto emit = [&](const MemoryAccess& a) {
+    Function* fn = function(a, a.size());
+    if (auto* load = dyn_cast<LoadInst>(a.inst)) {
+      CallInst* call = CallInst::Create(fn->getFunctionType(), fn, {a.addr}, "", load);
+      load->replaceAllUsesWith(call);
+    } else {
+      auto* val = cast<StoreInst>(a.inst)->getValueOperand();
+      CallInst::Create(fn->getFunctionType(), fn, {a.addr, val}, "", a.inst);
+    }
+    a.inst->eraseFromParent();
+  };
+
+  // accesses which are not whole bytes, or overlap, are left as they are.
+  std::vector<MemoryAccess> sorted = run;
+  std::stable_sort(sorted.begin(), sorted.end(),
+    [](auto& a, auto& b) { return a.offset < b.offset; });
+  bool mergeable = std::all_of(run.begin(), run.end(),
+    [](auto& a) { return a.ty->isIntegerTy() && a.size() % 8 == 0; });
+  for (size_t i = 1; mergeable && i < sorted.size(); i++) {
+    mergeable = sorted[i-1].offset + sorted[i-1].size() / 8 <= sorted[i].offset;
+  }
+  if (!mergeable || run.size() == 1) {
+    for (auto& a : run)
+      emit(a);
+    run.clear();
+    return;
+  }
+
+  for (size_t i = 0; i < sorted.size(); ) {
+    // longest contiguous chain from i with a supported total width.
+    size_t end = i;
+    unsigned total = sorted[i].size();
+    unsigned width = 0;
+    for (size_t j = i + 1; j < sorted.size(); j++) {
+      if (sorted[j].offset != sorted[j-1].offset + sorted[j-1].size() / 8)
+        break;
+      total += sorted[j].size();
+      if (total > 128)
+        break;
+      if (fns.contains(total)) {
+        end = j;
+        width = total;
+      }
+    }
+
+    if (end == i) {
+      emit(sorted[i]);
+      i++;
+      continue;
+    }
+
+    auto chain = std::span(sorted).subspan(i, end - i + 1);
+    std::vector<Instruction*> insts;
+    for (auto& a : chain)
+      insts.push_back(a.inst);
+    // loads are merged at the first load in program order, stores at the last.
+    auto pos = std::find_if(run.begin(), run.end(),
+      [&](auto& a) { return std::find(insts.begin(), insts.end(), a.inst) != insts.end(); });
+    auto rpos = std::find_if(run.rbegin(), run.rend(),
+      [&](auto& a) { return std::find(insts.begin(), insts.end(), a.inst) != insts.end(); });
+
+    IRBuilder irb{isLoad ? pos->inst : rpos->inst};
+    Type* wideTy = Type::getIntNTy(Context, width);
+    Type* addrTy = chain[0].addr->getType();
+    int64_t lo = chain[0].offset;
+    Value* addr = !chain[0].base ? ConstantInt::get(addrTy, lo)
+      : lo != 0 ? irb.CreateAdd(chain[0].base, ConstantInt::get(addrTy, lo))
+      : chain[0].base;
+    Function* fn = function(chain[0], width);
+
+    if (isLoad) {
+      Value* wide = irb.CreateCall(fn->getFunctionType(), fn, {addr});
+      for (auto& a : chain) {
+        IRBuilder irb{a.inst};
+        unsigned shift = (a.offset - lo) * 8;
+        Value* val = shift > 0 ? irb.CreateLShr(wide, shift) : wide;
+        a.inst->replaceAllUsesWith(irb.CreateTrunc(val, a.ty));
+        a.inst->eraseFromParent();
+      }
+    } else {
+      Value* acc = nullptr;
+      for (auto& a : chain) {
+        unsigned shift = (a.offset - lo) * 8;
+        Value* val = irb.CreateZExt(cast<StoreInst>(a.inst)->getValueOperand(), wideTy);
+        val = shift > 0 ? irb.CreateShl(val, shift) : val;
+        acc = acc ? irb.CreateOr(acc, val) : val;
+      }
+      irb.CreateCall(fn->getFunctionType(), fn, {addr, acc});
+      for (auto& a : chain)
+        a.inst->eraseFromParent();
+    }
+    i = end + 1;
+  }
+  run.clear();
+}
+
 void correctMemoryAccesses(Module& m, Function& root) {
-  std::initializer_list<int> sizes = { 8, 16, 32, 64 };
+  std::initializer_list<int> sizes = { 8, 16, 32, 64, 128 };
 
   std::map<int, Function*> loads;
   std::map<int, Function*> stores;
@@ -224,36 +727,109 @@ void correctMemoryAccesses(Module& m, Function& root) {
     stores[sz] = store;
   }
 
+  // memory accesses through inttoptr, by instruction.
+  std::map<Instruction*, MemoryAccess> accesses;
+
   for (BasicBlock& bb : root) for (Instruction& inst : bb) {
     IntToPtrInst* i2p = dyn_cast<IntToPtrInst>(&inst);
     if (!i2p) continue; 
     for (User* u : clone_it(i2p->users())) {
       auto* addr = i2p->getOperand(0);
+      auto [base, offset] = decomposeAddress(addr);
       if (auto* load = dyn_cast<LoadInst>(u)) {
-        
-        int sz = load->getType()->getIntegerBitWidth();
-        CallInst* call = CallInst::Create(loads[sz]->getFunctionType(), loads.at(sz), {addr}, "", load);
-        load->replaceAllUsesWith(call);
-        load->eraseFromParent();
+        accesses[load] = {load, addr, base, offset, load->getType()};
+      } else if (auto* stor = dyn_cast<StoreInst>(u); stor && stor->getPointerOperand() == i2p) {
+        accesses[stor] = {stor, addr, base, offset, stor->getValueOperand()->getType()};
+      } else {
+        unsupported(TranslationError::Memory, "unsupported use of int2ptr cast", u);
+      }
+    }
+  }
 
-      } else if (auto* stor = dyn_cast<StoreInst>(u)) {
-        auto* val = stor->getValueOperand();
-        int sz = stor->getValueOperand()->getType()->getIntegerBitWidth();
-        CallInst* call = CallInst::Create(stores[sz]->getFunctionType(), stores.at(sz), {addr, val}, "", stor);
-        stor->replaceAllUsesWith(call);
-        stor->eraseFromParent();
+  // accesses are grouped into runs of loads (or stores) from the same base
+  // address, uninterrupted by any other instruction which may touch memory.
+  // merging is opt-in ($COALESCE_MEMORY), since it happens before any
+  // simplification and compares bases by identity, so lifters of the same
+  // access may still be merged differently, into unrelated load_N calls.
+  static const bool coalesce = getenv("COALESCE_MEMORY") != nullptr;
+  for (BasicBlock& bb : root) {
+    std::vector<MemoryAccess> run;
+    for (Instruction& inst : make_early_inc_range(bb)) {
+      auto it = accesses.find(&inst);
+      if (it == accesses.end()) {
+        if (mayAccessMemory(inst)) {
+          coalesceAccesses(run, loads, stores);
+        }
+        continue;
+      }
 
-      } else {
-        errs() << *u << '\n';
-        assert(0 && "unsupported use of int2ptr cast");
+      MemoryAccess& access = it->second;
+      if (!run.empty() && (!coalesce || run[0].isLoad() != access.isLoad() || run[0].base != access.base)) {
+        coalesceAccesses(run, loads, stores);
       }
+      run.push_back(access);
     }
+    coalesceAccesses(run, loads, stores);
+  }
 
-    assert(i2p->isSafeToRemove() && "unable to remove i2p instruction");
+  for (BasicBlock& bb : root) for (Instruction& inst : bb) {
+    if (auto* i2p = dyn_cast<IntToPtrInst>(&inst)) {
+      if (!i2p->isSafeToRemove())
+        unsupported(TranslationError::Memory, "unable to remove inttoptr", i2p);
+    }
   }
 }
 
 
+std::set<std::string> writtenGlobals(Function& root) {
+    std::set<std::string> written{};
+    for (auto& bb : root) for (auto& inst : bb) {
+        if (auto* store = dyn_cast<StoreInst>(&inst)) {
+            if (auto* glo = dyn_cast<GlobalVariable>(store->getPointerOperand()))
+                written.insert(glo->getName().str());
+        }
+    }
+    return written;
+}
+
+bool loadsAfterStores(Function& root) {
+    auto calls = [](Instruction& inst, StringRef prefix) {
+        auto* call = dyn_cast<CallInst>(&inst);
+        Function* fn = call ? call->getCalledFunction() : nullptr;
+        return fn && fn->getName().startswith(prefix);
+    };
+
+    bool stored = false;
+    bool loaded = false;
+    for (auto& bb : root) for (auto& inst : bb) {
+        if (calls(inst, "store_")) {
+            stored = true;
+        } else if (calls(inst, "load_")) {
+            // in straight-line code, only loads after the first store can see it.
+            if (stored)
+                return true;
+            loaded = true;
+        }
+    }
+    return stored && loaded && root.size() > 1;
+}
+
+AllocaInst* internaliseGlobal(Function& root, GlobalVariable* glo) {
+    Instruction* insertion = &*root.getEntryBlock().getFirstInsertionPt();
+    Type* ty = glo->getValueType();
+
+    auto* alloc = new AllocaInst(ty, /*addrspace*/0, /*arraysize*/nullptr,
+        glo->getName() + ".local", insertion);
+    auto* init = new LoadInst(ty, glo, "", insertion);
+    new StoreInst(init, alloc, insertion);
+
+    glo->replaceUsesWithIf(alloc, [&](Use& u) {
+        auto* inst = dyn_cast<Instruction>(u.getUser());
+        return u.getUser() != init && inst && inst->getFunction() == &root;
+    });
+    return alloc;
+}
+
 BasicBlock& newEntryBlock(Function& f) {
     assertm(!f.empty(), "analysed function must not be empty");
     BasicBlock* oldEntry = f.empty() ? nullptr : &f.getEntryBlock();
@@ -318,8 +894,8 @@ std::vector<std::reference_wrapper<ReturnInst>> functionReturns(Function& f) {
 
 ReturnInst& uniqueReturn(Function& f) {
     auto rets = functionReturns(f);
-    assert(rets.size() > 0 && "no returns in function");
-    assert(rets.size() == 1 && "multiple returns in function");
+    if (rets.size() != 1)
+        unsupported(TranslationError::Input, std::to_string(rets.size()) + " returns in function " + f.getName().str());
     return rets[0];
 }
 
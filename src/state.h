@@ -2,6 +2,8 @@
 
 #include <variant>
 #include <functional>
+#include <map>
+#include <set>
 
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Instructions.h"
@@ -21,10 +23,45 @@ extern const std::string entry_function_name;
 Function* findFunction(Module& m, std::string const& name);
 AllocaInst* findLocalVariable(Function& f, std::string const& name);
 std::vector<GlobalVariable*> generateGlobalState(Module& m, Function& f);
+void pruneGlobalState(std::vector<GlobalVariable*>& globals);
 void correctGlobalAccesses(const std::vector<GlobalVariable*>& globals);
 void correctMemoryAccesses(Module& m, Function& root);
 void noundef(LoadInst*);
 
+/**
+ * Half-open range [lo, hi) of bits of a global register.
+ */
+struct BitRange {
+    unsigned lo;
+    unsigned hi;
+};
+
+// bits of each used integer global which are read, or the full width if it is
+// written or read in an unrecognised way. empty (lo >= hi) if no bits are read.
+std::map<std::string, BitRange> liveGlobalBits(Module& m);
+// replaces a read-only global with one holding only the given bits.
+GlobalVariable* narrowGlobal(Module& m, GlobalVariable* glo, BitRange range);
+
+// replaces the X and V registers selected by encoding fields (name ->
+// register number in this instance) with elements of a [32 x iN] register
+// file indexed by new i5 parameters of root, one per register in order of
+// number. fields selecting the same register share a parameter. other
+// registers of the class become constant elements, and the field registers
+// are assumed distinct from each other, from those, and from 31. implicit
+// registers, which the instruction uses whatever its fields, must not be
+// selected by a field, since they cannot be told apart by number.
+void templateRegisters(Module& m, const std::map<std::string, unsigned>& fields,
+    const std::set<unsigned>& implicit);
+
+// names of globals stored to by root. stores through a register file (see
+// templateRegisters) are not included.
+std::set<std::string> writtenGlobals(Function& root);
+// whether a load_N call in root may observe an earlier store_N call.
+bool loadsAfterStores(Function& root);
+// redirects root's accesses of glo to a local copy initialised from it,
+// so that writes to glo are no longer observable.
+AllocaInst* internaliseGlobal(Function& root, GlobalVariable* glo);
+
 BasicBlock& newEntryBlock(Function& f);
 std::vector<AllocaInst*> internaliseGlobals(Module& module, Function& f);
 std::vector<AllocaInst*> internaliseParams(Function& f);
@@ -0,0 +1,297 @@
+#!/usr/bin/env python3
+
+# runs glue.sh jobs concurrently within a memory budget, in place of
+# `xargs -P 5 -L 1 ./glue.sh` in bulk.sh.
+#
+#   admit.py [--jobs N] [--budget MB] [--estimate MB] [--retries N]
+#            [--journal FILE [--resume] [--pending]] < jobs
+#
+# jobs are in bulk.sh's format (OPCODE 'OUTDIR' [FIELDS], e.g. from
+# schedule.py order) and run in order, at most N at once (default: one per
+# cpu). a job is only started when the budget (default: 90% of available
+# memory at start) has room for it on top of the running jobs, each counted
+# as the larger of its current RSS and its estimate. a new job's estimate
+# is the mean peak RSS of finished jobs, or --estimate before any finish.
+#
+# the RSS of a job is that of glue.sh and all its descendants (alive-tv,
+# solvers), read from /proc. if the total exceeds the budget, the largest
+# job is killed and requeued in the next concurrency class: class c only
+# runs while at most N / 2^c jobs are running (including itself), and
+# reserves its peak RSS. a job killed in a class where it runs alone, or
+# killed by something else (e.g. the OOM killer) more than --retries times,
+# is given up and noted in OUTDIR/OPCODE.err, and journalled as such.
+#
+# with --journal, progress is recorded in FILE (see Journal) and glue.sh
+# is given it as $JOURNAL. the journal is started afresh unless --resume is
+# given, which skips jobs the journal records as finished. --pending prints
+# the jobs which are not finished, without running any.
+
+import os
+import shlex
+import signal
+import subprocess
+import time
+
+from dataclasses import dataclass
+from pathlib import Path
+
+GLUE = Path(__file__).resolve().parent / 'glue.sh'
+PAGE = os.sysconf('SC_PAGE_SIZE')
+MB = 1 << 20
+INTERVAL = 0.5
+
+
+class Journal:
+  """Append-only record of a sweep's progress, one line of
+  OUTDIR OPCODE LIFTER STAGE (tab separated) per completed stage of a job.
+  glue.sh appends its stages (translate, vars, alive) without syncing. the
+  runner appends OUTDIR OPCODE - done when a job has finished, or - oom or
+  - failed when it was given up, and fsyncs the file after every `batch` of
+  those or `secs` seconds, so an interruption loses the stages of at most
+  that many jobs, which are then run again. given up jobs are not finished,
+  so they are also run again on resume."""
+
+  def __init__(self, path: str, resume: bool, batch: int = 16, secs: float = 30):
+    self.path = path
+    self.stages: dict[tuple[str, str], list[tuple[str, str]]] = {}
+    if resume and os.path.exists(path):
+      with open(path) as f:
+        for line in f:
+          words = line.rstrip('\n').split('\t')
+          if len(words) == 4:  # not cut off by a crash
+            self.stages.setdefault((words[0], words[1]), []).append((words[2], words[3]))
+    elif not resume:
+      open(path, 'w').close()
+    # appending, as glue.sh does, so neither overwrites the other.
+    self.file = open(path, 'a')
+    self.batch, self.secs = batch, secs
+    self.unsynced, self.synced = 0, time.monotonic()
+
+  def finished(self, job: 'Job') -> bool:
+    return ('-', 'done') in self.stages.get((job.outdir, job.op), [])
+
+  def reached(self, job: 'Job') -> str | None:
+    stages = self.stages.get((job.outdir, job.op))
+    return ' '.join(stages[-1]) if stages else None
+
+  def done(self, job: 'Job') -> None:
+    self.end(job, 'done')
+
+  def failed(self, job: 'Job', reason: str = 'failed') -> None:
+    self.end(job, reason)
+
+  def end(self, job: 'Job', stage: str) -> None:
+    self.file.write(f'{job.outdir}\t{job.op}\t-\t{stage}\n')
+    self.file.flush()
+    self.unsynced += 1
+    if self.unsynced >= self.batch or time.monotonic() - self.synced > self.secs:
+      self.sync()
+
+  def sync(self) -> None:
+    # also syncs glue.sh's appends, which are to the same file.
+    os.fsync(self.file.fileno())
+    self.unsynced, self.synced = 0, time.monotonic()
+
+
+@dataclass
+class Job:
+  op: str
+  outdir: str
+  args: list[str]
+  cls: int = 0  # concurrency class
+  reserve: int = 0  # bytes, from a previous attempt
+  attempts: int = 0
+
+
+@dataclass
+class Running:
+  job: Job
+  proc: subprocess.Popen
+  estimate: int
+  rss: int = 0
+  peak: int = 0
+
+
+def available() -> int:
+  for line in Path('/proc/meminfo').read_text().splitlines():
+    if line.startswith('MemAvailable:'):
+      return int(line.split()[1]) * 1024
+  raise RuntimeError('no MemAvailable in /proc/meminfo')
+
+
+def processes() -> dict[int, tuple[int, int]]:
+  """Parent and RSS in bytes of each process."""
+  procs = {}
+  for d in Path('/proc').iterdir():
+    if not d.name.isdigit():
+      continue
+    try:
+      stat = (d / 'stat').read_text()
+      rss = int((d / 'statm').read_text().split()[1]) * PAGE
+    except OSError:
+      continue  # exited
+    # the command name may contain spaces, the fields after it do not.
+    ppid = int(stat[stat.rindex(')') + 2:].split()[1])
+    procs[int(d.name)] = (ppid, rss)
+  return procs
+
+
+def descendants(pid: int, procs: dict[int, tuple[int, int]]) -> list[int]:
+  children = {}
+  for p, (ppid, _) in procs.items():
+    children.setdefault(ppid, []).append(p)
+  tree, stack = [], [pid]
+  while stack:
+    p = stack.pop()
+    tree.append(p)
+    stack += children.get(p, [])
+  return tree
+
+
+def kill(r: Running) -> None:
+  # descendants may have their own process groups (see portfolio.py).
+  for p in descendants(r.proc.pid, processes()):
+    try:
+      os.kill(p, signal.SIGKILL)
+    except OSError:
+      pass
+  r.proc.wait()
+
+
+def note(job: Job, msg: str) -> None:
+  print(f'{job.op}: {msg}', flush=True)
+  Path(job.outdir).mkdir(parents=True, exist_ok=True)
+  with open(Path(job.outdir, f'{job.op}.err'), 'a') as f:
+    f.write(f'admit: {msg}\n')
+
+
+def run(pending: list[Job], jobs: int, budget: int, estimate: int, retries: int,
+        journal: Journal | None) -> None:
+  running: list[Running] = []
+  peaks: list[int] = []
+  total = len(pending)
+  done = 0
+
+  def limit(cls: int) -> int:
+    return max(1, jobs >> cls)
+
+  def reserved() -> int:
+    return sum(max(r.rss, r.estimate) for r in running)
+
+  while pending or running:
+    # admit jobs in order while there is room. a job which does not fit
+    # holds back the rest, so large jobs are not starved.
+    while pending:
+      job = pending[0]
+      need = job.reserve or (sum(peaks) // len(peaks) if peaks else estimate)
+      slots = min([limit(job.cls)] + [limit(r.job.cls) for r in running])
+      if len(running) >= slots or (running and reserved() + need > budget):
+        break
+      pending.pop(0)
+      proc = subprocess.Popen([str(GLUE), job.op, job.outdir, *job.args])
+      running.append(Running(job, proc, need))
+
+    time.sleep(INTERVAL)
+
+    procs = processes()
+    for r in running:
+      r.rss = sum(procs.get(p, (0, 0))[1] for p in descendants(r.proc.pid, procs))
+      r.peak = max(r.peak, r.rss)
+
+    if sum(r.rss for r in running) > budget:
+      r = max(running, key=lambda r: r.rss)
+      kill(r)
+      running.remove(r)
+      job = r.job
+      if limit(job.cls) == 1:
+        done += 1
+        note(job, f'killed at {r.peak // MB} MB, over the budget of {budget // MB} MB when run alone')
+        if journal: journal.failed(job, 'oom')
+      else:
+        job.cls += 1
+        job.reserve = r.peak
+        print(f'{job.op}: killed at {r.peak // MB} MB, requeued in class {job.cls}', flush=True)
+        pending.append(job)
+
+    for r in [r for r in running if r.proc.poll() is not None]:
+      running.remove(r)
+      job, status = r.job, r.proc.returncode
+      # glue.sh exits with grep's 0 or 1, anything else means it was killed.
+      if status not in (0, 1) and job.attempts < retries:
+        job.attempts += 1
+        job.cls += 1
+        job.reserve = max(job.reserve, r.peak)
+        print(f'{job.op}: exited with {status}, retry {job.attempts} in class {job.cls}', flush=True)
+        pending.append(job)
+        continue
+      done += 1
+      if journal:
+        journal.done(job) if status in (0, 1) else journal.failed(job)
+      peaks.append(r.peak)
+      print(f'{done}/{total} {job.op} status {status} peak {r.peak // MB} MB', flush=True)
+
+  if journal:
+    journal.sync()
+
+
+def parse_jobs(lines) -> list[Job]:
+  jobs = []
+  for line in lines:
+    words = shlex.split(line)
+    if len(words) >= 2:
+      jobs.append(Job(words[0], words[1], words[2:]))
+  return jobs
+
+
+def main(argv):
+  args = argv[1:]
+  jobs, budget, estimate, retries = os.cpu_count() or 1, None, 512, 2
+  journal, resume, pending = None, False, False
+  while args:
+    a = args.pop(0)
+    if a == '--jobs': jobs = int(args.pop(0))
+    elif a == '--budget': budget = int(args.pop(0)) * MB
+    elif a == '--estimate': estimate = int(args.pop(0))
+    elif a == '--retries': retries = int(args.pop(0))
+    elif a == '--journal': journal = args.pop(0)
+    elif a == '--resume': resume = True
+    elif a == '--pending': pending = True
+    else: assert False, "usage: admit.py [--jobs N] [--budget MB] [--estimate MB] [--retries N] " \
+                        "[--journal FILE [--resume] [--pending]] < jobs"
+
+  lines = [l for l in sys.stdin if parse_jobs([l])]
+  if pending:
+    assert journal and resume, "--pending requires --journal and --resume"
+    j = Journal(journal, resume)
+    print(''.join(l for l in lines if not j.finished(parse_jobs([l])[0])), end='')
+    return
+
+  todo = parse_jobs(lines)
+  if journal:
+    j = Journal(journal, resume)
+    os.environ['JOURNAL'] = os.path.abspath(journal)
+    finished = [job for job in todo if j.finished(job)]
+    todo = [job for job in todo if not j.finished(job)]
+    for job in todo:
+      if j.reached(job) in ('- oom', '- failed'):
+        print(f'{job.op}: given up before ({j.reached(job)[2:]}), running again', flush=True)
+      elif j.reached(job):
+        print(f'{job.op}: interrupted after {j.reached(job)}, running again', flush=True)
+    if resume:
+      print(f'resuming, {len(finished)} jobs already finished', flush=True)
+    journal = j
+
+  if budget is None:
+    budget = available() * 9 // 10
+  print(f'admitting up to {jobs} jobs within {budget // MB} MB', flush=True)
+  try:
+    run(todo, jobs, budget, estimate * MB, retries, journal)
+  except KeyboardInterrupt:
+    if journal:
+      journal.sync()
+      print('interrupted, unfinished jobs will be run by --resume', flush=True)
+    sys.exit(130)
+
+if __name__ == '__main__':
+  import sys
+  main(sys.argv)
@@ -2,6 +2,13 @@
 
 
 set -e
+# with --resume, continues an interrupted sweep into the same directory,
+# skipping opcodes which its journal records as finished (see admit.py).
+resume=
+if [[ "$1" == --resume ]]; then
+  resume=1
+  shift
+fi
 out="$1"
 if [[ -z "$out" ]]; then
   echo "specify output directory as first argument"
@@ -9,6 +16,7 @@ if [[ -z "$out" ]]; then
 fi
 pwd="$(pwd)"
 mkdir -p "$out"
+journal="$pwd/$out/journal.tsv"
 cd $(dirname $0)
 
 . ./env.sh
@@ -17,15 +25,56 @@ export OCAMLRUNPARAM=b
 set +e
 
 files="$(find "$ASLI_DIR/tests/coverage" -maxdepth 1 -name 'aarch64_*')"
+d=/tmp/$(date -I)
+mkdir -p $d
+jobs=$(mktemp)
 for f in $files; do
   echo $f
   mkdir -p "$pwd/$out/$(basename $f)"
-  d=/tmp/$(date -I)
-  mkdir -p $d
-
-  ops=$(grep -R ' --> OK' "$f" --no-filename | cut -d: -f1)
-  echo "$ops" | sed -E "s#0x(..)(..)(..)(..)#:dump A64 0x\1\2\3\4 $d/\4\3\2\1.aslb#" | "$ASLI"
 
+  fields=
+  if [[ -n "$TEMPLATE" ]]; then
+    # opcodes generalised over their encoding's register fields, each
+    # with the fields and another instance (see sample.py), and concrete
+    # opcodes with nothing after them.
+    lines=$(./sample.py --template "$f")
+    ops=$(echo "$lines" | cut -d' ' -f1)
+    fields=$(echo "$lines" | awk '{ $1 = ""; print substr($0, 2) }' | sed 's/0x\(..\)\(..\)\(..\)\(..\)/\4\3\2\1/')
+  elif [[ -n "$SAMPLE_BUDGET" ]]; then
+    # stratified sample of each encoding's fields instead of the fixed list.
+    ops=$(./sample.py --budget "$SAMPLE_BUDGET" "$f")
+  else
+    ops=$(grep -R ' --> OK' "$f" --no-filename | cut -d: -f1)
+  fi
   #echo "$ops" | sed 's/0x\(..\)\(..\)\(..\)\(..\)/\4\3\2\1/' | xargs -n 1 ./get_mnemonic.sh
-  echo "$ops" | cat | sed 's/0x\(..\)\(..\)\(..\)\(..\)/\4\3\2\1/' | xargs -P 5 -i ./glue.sh '{}' "$pwd/$out/$(basename $f)" ';'
+  lines=$(echo "$ops" | sed 's/0x\(..\)\(..\)\(..\)\(..\)/\4\3\2\1/' | sed "s#\$# '$pwd/$out/$(basename $f)'#")
+  [[ -n "$fields" ]] && lines=$(paste -d' ' <(echo "$lines") <(echo "$fields"))
+  if [[ -n "$resume" ]]; then
+    lines=$(echo "$lines" | ./admit.py --journal "$journal" --resume --pending)
+    [[ -z "$lines" ]] && continue
+    ops=$(echo "$lines" | cut -d' ' -f1 | sed -E 's/(..)(..)(..)(..)/0x\4\3\2\1/')
+  fi
+
+  echo "$ops" | sed -E "s#0x(..)(..)(..)(..)#:dump A64 0x\1\2\3\4 $d/\4\3\2\1.aslb#" | "$ASLI"
+  if [[ -n "$ARCHIVE" ]]; then
+    # one archive instead of a file per opcode, see glue.sh.
+    find $d -maxdepth 1 -name '*.aslb' | xargs -r "$LLVM_TRANSLATOR" ar add "$ARCHIVE" && find $d -maxdepth 1 -name '*.aslb' -delete
+  fi
+  echo "$lines" >> $jobs
 done
+
+# one queue over all coverage files, longest expected jobs first.
+if [[ -n "$SHARD_PORT" ]]; then
+  # shared with workers on other hosts, which join with
+  # `tools/coordinator.py work THIS_HOST:$SHARD_PORT`. this host runs one too.
+  # other hosts can only connect if $SHARD_TOKEN is set (for all of them).
+  ./coordinator.py work --jobs 5 localhost:$SHARD_PORT &
+  ./schedule.py order < $jobs | ./coordinator.py serve --port $SHARD_PORT ${SHARD_TOKEN:+--bind 0.0.0.0} --journal "$journal" ${resume:+--resume}
+  wait
+else
+  # as many jobs as fit in memory, see admit.py. $JOBS and $MEM_BUDGET (MB)
+  # override its defaults of one job per cpu and 90% of available memory.
+  ./schedule.py order < $jobs | ./admit.py ${JOBS:+--jobs $JOBS} ${MEM_BUDGET:+--budget $MEM_BUDGET} \
+    --journal "$journal" ${resume:+--resume}
+fi
+rm -f $jobs
@@ -0,0 +1,327 @@
+#!/usr/bin/env python3
+
+# distributes glue.sh jobs over several hosts.
+#
+#   coordinator.py serve [--port P] [--bind ADDR] [--batch N] [--lease SECS] [--retries N]
+#                        [--journal FILE [--resume]] < jobs
+#     reads jobs in bulk.sh's format (OPCODE 'OUTDIR' [FIELDS], e.g. from
+#     schedule.py order) and leases them in batches of N to workers. each result is
+#     written to OUTDIR/OPCODE.{out,err} on this host, the same layout as
+#     bulk.sh, so log_parser.py works unchanged. exits once every job has a
+#     result. with --journal, finished jobs are recorded as by admit.py.
+#     duplicate jobs are run once. listens on localhost unless --bind is
+#     given, which requires $SHARD_TOKEN.
+#
+#   coordinator.py work [--jobs N] HOST:PORT
+#     runs N concurrent lease loops against a coordinator, calling glue.sh
+#     for each opcode and uploading its output. workers can run on any host
+#     with the dependencies in env.sh, including the coordinator's.
+#
+# a lease which is not renewed within --lease seconds (i.e. its worker has
+# died or lost its connection) is returned to the queue. jobs whose glue.sh
+# was killed (e.g. by the OOM killer) are retried up to --retries times,
+# then recorded with whatever output they left.
+#
+# workers report which opcodes they already have ASLi output for (see
+# bulk.sh) and are given those first, so cached artifacts are reused rather
+# than recomputed on another host.
+#
+# workers return the alive-tv timings glue.sh recorded for each job (see
+# schedule.py), which are added to this host's $TIMINGS.
+#
+# messages are single JSON lines, one request and one response per
+# connection. if $SHARD_TOKEN is set, it must be the same for the
+# coordinator and its workers, and is sent with every request.
+
+import hmac
+import json
+import os
+import shlex
+import socket
+import socketserver
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+from dataclasses import dataclass, field
+from datetime import date
+from pathlib import Path
+
+from admit import Journal
+from schedule import timings_file
+
+GLUE = Path(__file__).resolve().parent / 'glue.sh'
+TOKEN = os.environ.get('SHARD_TOKEN', '')
+
+
+@dataclass
+class Job:
+  id: int
+  op: str
+  outdir: str
+  args: list[str] = field(default_factory=list)  # further glue.sh arguments
+  attempts: int = 0
+
+  @property
+  def key(self) -> tuple[str, str]:
+    return self.op, self.outdir
+
+
+@dataclass
+class Lease:
+  id: int
+  worker: str
+  jobs: list[Job]
+  expires: float
+
+
+@dataclass
+class Coordinator:
+  pending: list[Job]
+  batch: int
+  lease_secs: float
+  retries: int
+  journal: Journal | None = None
+  leases: dict[int, Lease] = field(default_factory=dict)
+  finished: set = field(default_factory=set)
+  lock: threading.Lock = field(default_factory=threading.Lock)
+  all_done: threading.Event = field(default_factory=threading.Event)
+  next_id: int = 0
+
+  def __post_init__(self):
+    self.total = len(self.pending)
+    if not self.pending:
+      self.all_done.set()
+
+  def expire_leases(self) -> None:
+    with self.lock:
+      self.expire()
+
+  def expire(self) -> None:
+    now = time.monotonic()
+    for lease in [l for l in self.leases.values() if l.expires < now]:
+      print(f'lease {lease.id} of {lease.worker} expired, requeueing {len(lease.jobs)} jobs', flush=True)
+      del self.leases[lease.id]
+      self.pending[:0] = lease.jobs
+
+  def lease(self, worker: str, cached: list[str]) -> dict:
+    with self.lock:
+      self.expire()
+      if not self.pending:
+        return {'done': True} if self.all_done.is_set() else {'wait': min(5, self.lease_secs)}
+
+      # affinity: opcodes whose artifacts the worker already holds go first.
+      have = set(cached)
+      picked = [j for j in self.pending if j.op in have][:self.batch]
+      ids = {id(j) for j in picked}
+      picked += [j for j in self.pending if id(j) not in ids][:self.batch - len(picked)]
+      ids = {id(j) for j in picked}
+      self.pending = [j for j in self.pending if id(j) not in ids]
+
+      self.next_id += 1
+      lease = Lease(self.next_id, worker, picked, time.monotonic() + self.lease_secs)
+      self.leases[lease.id] = lease
+      return {'lease': lease.id, 'jobs': [[j.id, j.op, *j.args] for j in picked], 'seconds': self.lease_secs}
+
+  def renew(self, id: int) -> dict:
+    with self.lock:
+      if id not in self.leases:
+        return {'ok': False}
+      self.leases[id].expires = time.monotonic() + self.lease_secs
+      return {'ok': True}
+
+  def result(self, id: int, job: int, status: int, out: str, err: str, host: str = '',
+             timings: str = '') -> dict:
+    with self.lock:
+      lease = self.leases.get(id)
+      job = next((j for j in lease.jobs if j.id == job), None) if lease else None
+      if job is None:
+        # expired and requeued, the job will be done again.
+        return {'ok': False}
+      lease.jobs.remove(job)
+      if not lease.jobs:
+        del self.leases[id]
+
+      # a worker on this host has already recorded its timings here.
+      if timings and host != socket.gethostname():
+        with open(timings_file(), 'a') as f:
+          f.write(timings)
+
+      # glue.sh exits with grep's 0 or 1, anything else means it was killed.
+      if status not in (0, 1) and job.attempts < self.retries:
+        job.attempts += 1
+        print(f'{job.op} exited with {status} on {lease.worker}, retry {job.attempts}', flush=True)
+        self.pending.insert(0, job)
+        return {'ok': True}
+
+      if job.key not in self.finished:
+        self.finished.add(job.key)
+        Path(job.outdir).mkdir(parents=True, exist_ok=True)
+        Path(job.outdir, f'{job.op}.out').write_text(out)
+        Path(job.outdir, f'{job.op}.err').write_text(err)
+        print(f'{len(self.finished)}/{self.total} {job.op} status {status} from {lease.worker}', flush=True)
+        if self.journal:
+          self.journal.done(job) if status in (0, 1) else self.journal.failed(job)
+      if len(self.finished) == self.total:
+        if self.journal: self.journal.sync()
+        self.all_done.set()
+      return {'ok': True}
+
+
+def parse_jobs(lines) -> list[Job]:
+  """Jobs in order, without repeats of an opcode and output directory."""
+  jobs = []
+  seen = set()
+  for line in lines:
+    words = shlex.split(line)
+    if len(words) >= 2 and (words[0], words[1]) not in seen:
+      seen.add((words[0], words[1]))
+      jobs.append(Job(len(jobs), words[0], words[1], words[2:]))
+  return jobs
+
+
+def serve(coordinator: Coordinator, bind: str, port: int) -> None:
+  class Handler(socketserver.StreamRequestHandler):
+    def handle(self):
+      req = json.loads(self.rfile.readline())
+      if not hmac.compare_digest(req.pop('token', ''), TOKEN):
+        resp = {'error': 'bad token'}
+      else:
+        cmd = req.pop('cmd')
+        if cmd == 'lease': resp = coordinator.lease(**req)
+        elif cmd == 'renew': resp = coordinator.renew(**req)
+        elif cmd == 'result': resp = coordinator.result(**req)
+        else: resp = {'error': 'unknown command: ' + cmd}
+      self.wfile.write((json.dumps(resp) + '\n').encode())
+
+  socketserver.ThreadingTCPServer.allow_reuse_address = True
+  with socketserver.ThreadingTCPServer((bind, port), Handler) as server:
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+    print(f'serving {coordinator.total} jobs on {bind}:{port}', flush=True)
+    # leases also expire while no worker is asking for more.
+    while not coordinator.all_done.wait(min(5, coordinator.lease_secs)):
+      coordinator.expire_leases()
+    # let workers see that there is nothing left before shutting down.
+    time.sleep(min(5, coordinator.lease_secs))
+    server.shutdown()
+
+
+def request(addr: tuple[str, int], msg: dict) -> dict:
+  with socket.create_connection(addr) as s:
+    s.sendall((json.dumps({**msg, 'token': TOKEN}) + '\n').encode())
+    return json.loads(s.makefile().readline())
+
+
+def cached_ops() -> list[str]:
+  """Opcodes with ASLi output in today's artifact directory (see glue.sh)."""
+  return [f.stem for f in Path('/tmp', date.today().isoformat()).glob('*.aslb')]
+
+
+def timings_size() -> int:
+  try:
+    return os.path.getsize(timings_file())
+  except OSError:
+    return 0
+
+
+def timings_since(start: int, op: str) -> str:
+  """Timings of op recorded after offset start. other jobs of this worker
+  append to the same file, so their lines are told apart by opcode."""
+  try:
+    with open(timings_file()) as f:
+      f.seek(start)
+      return ''.join(l for l in f if l.startswith(op + '\t') and l.endswith('\n'))
+  except OSError:
+    return ''
+
+
+def work(addr: tuple[str, int], worker: str) -> None:
+  backoff = 1
+  while True:
+    try:
+      r = request(addr, {'cmd': 'lease', 'worker': worker, 'cached': cached_ops()})
+    except OSError:
+      # coordinator not up yet, restarting, or finished and gone.
+      if backoff > 60:
+        return
+      time.sleep(backoff)
+      backoff *= 2
+      continue
+    backoff = 1
+    if 'error' in r:
+      print(f'coordinator: {r["error"]}', file=sys.stderr)
+      return
+    if r.get('done'):
+      return
+    if 'wait' in r:
+      time.sleep(r['wait'])
+      continue
+
+    stop = threading.Event()
+    def renew():
+      while not stop.wait(r['seconds'] / 3):
+        try:
+          request(addr, {'cmd': 'renew', 'id': r['lease']})
+        except OSError:
+          pass
+    threading.Thread(target=renew, daemon=True).start()
+
+    try:
+      for job, op, *args in r['jobs']:
+        with tempfile.TemporaryDirectory() as d:
+          start = timings_size()
+          p = subprocess.run([str(GLUE), op, d, *args], stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+          out = Path(d, f'{op}.out')
+          err = Path(d, f'{op}.err')
+          request(addr, {'cmd': 'result', 'id': r['lease'], 'job': job, 'status': p.returncode,
+                         'out': out.read_text() if out.exists() else '',
+                         'err': err.read_text() if err.exists() else '',
+                         'host': socket.gethostname(), 'timings': timings_since(start, op)})
+    except OSError:
+      pass  # the lease will expire and be requeued.
+    finally:
+      stop.set()
+
+
+def main(argv):
+  args = argv[1:]
+  if not args or args[0] not in ('serve', 'work'):
+    sys.exit("usage: coordinator.py serve|work ...")
+  cmd = args.pop(0)
+  port, bind, batch, lease_secs, retries, jobs = 7300, 'localhost', 8, 600.0, 2, 5
+  journal, resume = None, False
+  rest = []
+  while args:
+    a = args.pop(0)
+    if a == '--port': port = int(args.pop(0))
+    elif a == '--bind': bind = args.pop(0)
+    elif a == '--batch': batch = int(args.pop(0))
+    elif a == '--lease': lease_secs = float(args.pop(0))
+    elif a == '--retries': retries = int(args.pop(0))
+    elif a == '--jobs': jobs = int(args.pop(0))
+    elif a == '--journal': journal = args.pop(0)
+    elif a == '--resume': resume = True
+    else: rest.append(a)
+
+  if cmd == 'serve':
+    if bind not in ('localhost', '127.0.0.1') and not TOKEN:
+      sys.exit("coordinator.py: --bind other than localhost requires $SHARD_TOKEN")
+    pending = parse_jobs(sys.stdin)
+    if journal:
+      journal = Journal(journal, resume)
+      pending = [j for j in pending if not journal.finished(j)]
+    serve(Coordinator(pending, batch, lease_secs, retries, journal), bind, port)
+  else:
+    if len(rest) != 1:
+      sys.exit("usage: coordinator.py work [--jobs N] HOST:PORT")
+    host, _, p = rest[0].rpartition(':')
+    addr = (host, int(p))
+    threads = [threading.Thread(target=work, args=(addr, f'{socket.gethostname()}:{os.getpid()}.{i}'))
+               for i in range(jobs)]
+    for t in threads: t.start()
+    for t in threads: t.join()
+
+if __name__ == '__main__':
+  main(sys.argv)
@@ -39,6 +39,14 @@ export CAPSTONE=$(search retdec-capstone2llvmir "$CAPSTONE" $DIR/../retdec/build
 export ALIVE=$(search alive-tv "$ALIVE" $DIR/../alive2/build/alive-tv alive-tv)
 export ASLI_DIR=$(search-d asli tests/coverage "$ASLI_DIR" "$(dirname $ASLI)" ~/.nix-profile/share/asli)
 
+# alive-tv --smt-to upper bound, and the timing history used to schedule
+# opcodes and pick initial timeouts (see schedule.py).
+export SMT_TIMEOUT=${SMT_TIMEOUT:-20000}
+export TIMINGS=${TIMINGS:-${XDG_CACHE_HOME:-$HOME/.cache}/llvm-translator/timings.tsv}
+
+# named opt pipelines for post.sh and `llvm-translator opt`.
+export PASS_PRESETS=${PASS_PRESETS:-$DIR/tools/presets.txt}
+
 for v in "$ASLI" "$ASL_TRANSLATOR" "$LLVM_TRANSLATOR" "$CAPSTONE" "$ALIVE" "$ASLI_DIR"; do
   if [[ -z "$v" ]]; then
     exit 1
@@ -1,16 +1,28 @@
 #!/bin/bash
 
 
-# glue.sh [opcode] [output directory]
+# glue.sh [opcode] [output directory] [template fields] [other opcode]
 # opcode in little endian compressed format.
 # output directory is optional,
 # if given, log output is written to [opcode].{err,out}
 # in that directory
+# template fields (or $TEMPLATE_FIELDS), e.g. Rd=1,Rn=2, are the
+# register fields of the opcode's encoding and their values in this
+# opcode. if given, the comparison covers every choice of distinct
+# registers for those fields (see `llvm-translator template`). other
+# opcode (or $TEMPLATE_OTHER) is an instance of the same encoding whose
+# fields select none of those registers, used to find the registers the
+# instruction uses implicitly, which cannot be templated.
 #
 # LLVM and ASL files are written to a subfolder of
 # /tmp with the date. the subfolder path is logged.
+# if $ARCHIVE is set (an absolute path to a .ltar file), they are
+# instead appended to that archive, keyed by file name, and the
+# working files are removed. see `llvm-translator ar`.
 
 d="$2"
+# kept for the journal, since d is reused for the work directory.
+outdir="$2"
 if ! [[ -z "$d" ]]; then
   echo "$d/$1.out" "$d/$1.err" >&2
   exec 2>"$d/$1.err"
@@ -31,11 +43,11 @@ function asli() {
   op="$1"
   f=$2
 
-  a=${op:0:2}
-  b=${op:2:2}
-  c=${op:4:2}
-  d=${op:6:2}
-  hex="0x${d}${c}${b}${a}"
+  local a=${op:0:2}
+  local b=${op:2:2}
+  local c=${op:4:2}
+  local d=${op:6:2}
+  local hex="0x${d}${c}${b}${a}"
 
   echo :dump A64 $hex "$f" | "$ASLI"
   x=$?
@@ -73,40 +85,154 @@ function llvm_translate() {
   "$LLVM_TRANSLATOR" $mode $in 2>&1 1>${out}tmp
   x=$?
   cat ${out}tmp | tools/post.sh > $out
+  metrics $mode.translate ${out}tmp
+  metrics $mode.post $out
   rm -f ${out}tmp
 
   return $x
 }
 
+function metrics() {
+  # structural metrics of the root function, see log_parser.py.
+  "$LLVM_TRANSLATOR" stats $1 $2 2>/dev/null
+}
+
 function llvm_translate_vars() {
   "$LLVM_TRANSLATOR" vars $@
   x=$?
   return $x
 }
 
-function alive() {
-  a=${op:0:2}
-  b=${op:2:2}
-  c=${op:4:2}
-  d=${op:6:2}
-  hex="0x${d}${c}${b}${a}"
+function header() {
+  local a=${op:0:2}
+  local b=${op:2:2}
+  local c=${op:4:2}
+  local d=${op:6:2}
+  local hex="0x${d}${c}${b}${a}"
 
   echo '|' $hex
   echo '|' $1
   echo '|' $2
+}
+
+function alive() {
+  header $1 $2
+
+  # identical up to names and operand order, so the solver is not needed.
+  if "$LLVM_TRANSLATOR" same $1 $2 >/dev/null 2>&1; then
+    echo "These functions seem to be equivalent! (syntactically identical, alive-tv skipped)"
+    return
+  fi
+
+  # start with a timeout predicted from previous runs and escalate
+  # to the full $SMT_TIMEOUT only if that is not enough.
+  # with $PORTFOLIO set, every run at the full limit races that many
+  # solver configurations (see portfolio.py), so the race starts as soon
+  # as the query is escalated rather than after a full run times out.
+  lifter=$3
+  to=$(./tools/schedule.py timeout $op "$mnem" $lifter)
+  while true; do
+    raced=
+    [[ -n "$PORTFOLIO" ]] && (( to >= SMT_TIMEOUT )) && raced=1
+    start=$(date +%s.%N)
+    args=(--time-verify --smt-stats --bidirectional --disable-undef-input --disable-poison-input --smt-to=$to $1 $2)
+    # stderr goes to our stderr as before, but may also report the timeout.
+    errf=$(mktemp)
+    if [[ -n "$raced" ]]; then
+      out="$(./tools/portfolio.py race --jobs $PORTFOLIO ${SMT_DUMP:+--dump $SMT_DUMP/$op.$lifter} -- "${args[@]}" 2>$errf)"
+    else
+      out="$("$ALIVE" "${args[@]}" 2>$errf)"
+    fi
+    err="$(cat $errf)"
+    rm -f $errf
+    [[ -n "$err" ]] && echo "$err" >&2
+    secs=$(awk "BEGIN { print $(date +%s.%N) - $start }")
+
+    if echo "$out" | grep -q 'seem to be equivalent'; then
+      verdict=equivalent
+    elif echo "$out$err" | grep -q 'Timeout'; then
+      verdict=timeout
+    else
+      verdict=other
+    fi
+    ./tools/schedule.py record $op "$mnem" $lifter${raced:+.portfolio} $to $secs $verdict
+
+    if [[ $verdict == timeout ]] && (( to < SMT_TIMEOUT )); then
+      echo "smt timeout of $to ms exceeded, escalating to $SMT_TIMEOUT ms${PORTFOLIO:+, racing $PORTFOLIO solver configurations}"
+      to=$SMT_TIMEOUT
+      continue
+    fi
+    break
+  done
+  echo "$out"
+}
 
-  "$ALIVE" --time-verify --smt-stats --bidirectional --disable-undef-input --disable-poison-input --smt-to=20000 $1 $2
+# verifies each register slice of $1 against $2 (see llvm-translator slice)
+# as a separate query, in parallel. prints one verdict per slice and the
+# output of slices which did not verify. equivalent only if every slice is.
+function alive_sliced() {
+  src=$1
+  tgt=$2
+  lifter=$3
+  sd=$(dirname $src)/$op.slices
+  mkdir -p $sd
+
+  slices=$("$LLVM_TRANSLATOR" slice $sd $src $tgt) || { alive $src $tgt $lifter; return; }
+
+  header $src $tgt
+  for s in $slices; do
+    alive $sd/$(basename $src .ll).$s.ll $sd/$(basename $tgt .ll).$s.ll $lifter.$s > $sd/$lifter.$s.out &
+    while (( $(jobs -rp | wc -l) >= ${SLICE_JOBS:-$(nproc)} )); do wait -n; done
+  done
+  wait
+
+  ok=1
+  for s in $slices; do
+    f=$sd/$lifter.$s.out
+    if grep -q 'seem to be equivalent' $f; then
+      echo "slice $s: equivalent"
+    else
+      grep -q 'Timeout' $f && echo "slice $s: timeout" || echo "slice $s: not verified"
+      ok=0
+    fi
+  done
+  for s in $slices; do
+    f=$sd/$lifter.$s.out
+    grep -q 'seem to be equivalent' $f || grep -v '^| ' $f
+  done
+  if [[ $ok == 1 ]]; then
+    echo "These functions seem to be equivalent! (all $(echo $slices | wc -w) slices)"
+  fi
+}
+
+function journal() {
+  [[ -n "$JOURNAL" ]] && printf '%s\t%s\t%s\t%s\n' "$outdir" "$op" "$1" "$2" >> "$JOURNAL"
+  return 0
 }
 
 function prefix() {
   sed "s/^/$1 --> /"
 }
 
+function archive() {
+  "$LLVM_TRANSLATOR" ar add "$ARCHIVE" $(find "$work" -maxdepth 1 -type f)
+  rm -rf "$work"
+}
+
 function main() {
   op=$1
 
   d=/tmp/$(date -I)
   mkdir -p $d
+  if [[ -n "$ARCHIVE" ]]; then
+    # bulk.sh leaves ASLi output in $d, or imports it into the archive.
+    cached=$d/$op.aslb
+    work=$(mktemp -d)
+    d=$work
+    test -f $cached && cp $cached $d/
+    test -f $d/$op.aslb || "$LLVM_TRANSLATOR" ar get "$ARCHIVE" $op.aslb > $d/$op.aslb || rm -f $d/$op.aslb
+    trap archive EXIT
+  fi
 
   aslb=$d/$op.aslb
   asl=$d/$op.asl
@@ -120,6 +246,7 @@ function main() {
   alive=$d/$op.alive.out
 
   mnemonic $op | prefix $op
+  mnem=$(mnemonic $op | awk '{print $1}')
 
   # asli $op $aslb
   test -f $aslb || { echo "executing ASLI"; asli $op $aslb; }
@@ -130,16 +257,49 @@ function main() {
 
   set -o pipefail
   asl_translate $aslb $asl | prefix $op       || { echo "$op ==> asl-translator fail"; exit 4; }
-  llvm_translate $cap $capll cap | prefix $op || { echo "$op ==> llvm-translator cap fail"; }
-  llvm_translate $rem $remll rem | prefix $op || { echo "$op ==> llvm-translator rem fail"; }
+  llvm_translate $cap $capll cap | prefix $op && journal cap translate || { echo "$op ==> llvm-translator cap fail"; }
+  llvm_translate $rem $remll rem | prefix $op && journal rem translate || { echo "$op ==> llvm-translator rem fail"; }
   llvm_translate $asl $aslll asl | prefix $op || { echo "$op ==> llvm-translator asl fail"; exit 7; }
-  llvm_translate_vars $aslll $capll $remll    || { echo "$op ==> llvm-translator vars fail"; exit 8; }
+  journal asl translate
+  # status 2: some lifter's module was unsupported and skipped, the rest are still compared.
+  llvm_translate_vars $aslll $capll $remll 2>&1 | prefix $op
+  x=$?
+  (( x == 2 )) && echo "$op ==> llvm-translator vars skipped unsupported modules"
+  (( x != 0 && x != 2 )) && { echo "$op ==> llvm-translator vars fail"; exit 8; }
+  { metrics asl.vars $aslll; metrics cap.vars $capll; metrics rem.vars $remll; } | prefix $op
+  journal - vars
+
+  fields=${2:-$TEMPLATE_FIELDS}
+  other=${3:-$TEMPLATE_OTHER}
+  templated=
+  if [[ -n "$fields" ]]; then
+    # registers of the other instance are implicit or fixed. it is lifted
+    # with capstone, the quickest lifter, in a subshell as capstone sets $op.
+    othercap=$d/$op.other.cap
+    otherll=$d/$op.other.cap.ll
+    if [[ -z "$other" ]]; then
+      echo "$op ==> no other instance to template against, comparing concrete opcode"
+    elif ! ( capstone $other $othercap && "$LLVM_TRANSLATOR" cap $othercap > $otherll 2>/dev/null ); then
+      echo "$op ==> other instance $other not lifted, comparing concrete opcode"
+    elif "$LLVM_TRANSLATOR" template "$fields" $otherll $aslll $capll $remll 2>&1 | prefix $op; then
+      echo "$op ==> template over $fields"
+      templated=1
+    else
+      echo "$op ==> llvm-translator template fail, comparing concrete opcode"
+    fi
+  fi
 
   rm -f ${alive}{.rem,.cap,}
   mnemonic $op >> $alive.cap
   mnemonic $op >> $alive.rem
-  alive $capll $aslll >> $alive.cap
-  alive $remll $aslll >> $alive.rem
+  # with DECOMPOSE set, each written register is verified separately.
+  # templates are not sliced, see `llvm-translator slice`.
+  verify=alive
+  [[ -n "$DECOMPOSE" && -z "$templated" ]] && verify=alive_sliced
+  $verify $capll $aslll cap >> $alive.cap
+  journal cap alive
+  $verify $remll $aslll rem >> $alive.rem
+  journal rem alive
 
   cat $alive.cap >> $alive
   echo ========================================== >> $alive
@@ -149,10 +309,9 @@ function main() {
     "seems to be correct|equivalent|reverse|doesn't verify|ERROR:|UB triggered|^[|] |failed" $alive \
     | prefix $op
 
-  echo $capll
-  echo $remll
-  echo $aslll
-  echo $alive
+  for f in $capll $remll $aslll $alive; do
+    [[ -n "$ARCHIVE" ]] && echo "$ARCHIVE#$(basename $f)" || echo $f
+  done
   cap=$(grep 'seem to be equivalent' $alive.cap | wc -l)
   rem=$(grep 'seem to be equivalent' $alive.rem | wc -l)
   if [[ $cap == 1 && $rem == 1 ]]; then
@@ -162,6 +321,6 @@ function main() {
   fi
 }
 
-x="$(main "$1")"
+x="$(main "$1" "$3" "$4")"
 echo "$x"
 exec echo "$x" | grep -q 'SUCCESS'
@@ -8,7 +8,7 @@ import csv
 import collections
 import itertools
 
-from dataclasses import dataclass
+from dataclasses import dataclass, field
 from itertools import chain, islice, repeat
 from typing import Generic, Iterator, Literal, TypeVar, Callable
 
@@ -75,6 +75,34 @@ class Result:
   rem: LifterResult = 'unknown'
   detail: str = ''
   errors: str = ''
+  # '{stage}_{key}' -> value, e.g. cap.vars_insts, plus '{lifter}_alive_s'
+  # and '{lifter}_syntactic' if alive-tv was skipped.
+  metrics: dict = field(default_factory=dict)
+
+METRIC_KEYS = ['insts', 'blocks', 'maxwidth', 'loads', 'stores', 'globals']
+
+def parse_metrics(detail: str) -> dict:
+  """Parses the 'metrics STAGE key=value ...' lines printed by glue.sh."""
+  out = {}
+  for line in detail.splitlines():
+    line = line.split(' --> ', 1)[-1]
+    if not line.startswith('metrics '): continue
+    _, stage, *pairs = line.split()
+    for pair in pairs:
+      k, _, v = pair.partition('=')
+      if k in METRIC_KEYS:
+        out[f'{stage}_{k}'] = int(v)
+  return out
+
+def load_alive_times(fname: str) -> dict[tuple[str, str], float]:
+  """Latest alive-tv time of each (opcode, lifter) from schedule.py's timings."""
+  times = {}
+  with open(fname) as f:
+    for line in f:
+      fields = line.rstrip('\n').split('\t')
+      if len(fields) == 6:
+        times[fields[0], fields[2]] = float(fields[4])
+  return times
 
 def get_result(block: str) -> tuple[bool, LifterResult]:
   if 'These functions seem to be equivalent!' in block: 
@@ -122,7 +150,7 @@ def parse_op(f: PeekIterator[str], op: str) -> Result:
   if 'asl-translator fail' in detail: 
     return Result(op, mnemonic, '', False, detail=detail)
   if 'llvm-translator vars fail' in detail: 
-    return Result(op, mnemonic, '', False, detail=detail)
+    return Result(op, mnemonic, '', False, detail=detail, metrics=parse_metrics(detail))
 
   head = ''.join(takewhile(lambda x: ' --> | ' not in x, l))
   hypercall = 'hyper_call' in head
@@ -147,16 +175,38 @@ def parse_op(f: PeekIterator[str], op: str) -> Result:
   rem_bool,rem = get_result(rem_block)
   if hypercall: rem = 'hypercall'
 
-  return Result(op, mnemonic, '', True, (cap_bool), (rem_bool), cap, rem, detail)
+  metrics = parse_metrics(detail)
+  for lifter, block in [('cap', cap_block), ('rem', rem_block)]:
+    metrics[f'{lifter}_syntactic'] = int('syntactically identical' in block)
+
+  return Result(op, mnemonic, '', True, (cap_bool), (rem_bool), cap, rem, detail, metrics=metrics)
+
+
+def print_correlations(results: list[Result]) -> None:
+  """Correlation of each final-stage metric with alive-tv time."""
+  import statistics
+  for lifter in ['cap', 'rem']:
+    for k in METRIC_KEYS:
+      pairs = [(r.metrics[f'{lifter}.vars_{k}'], r.metrics[f'{lifter}_alive_s']) for r in results
+        if f'{lifter}.vars_{k}' in r.metrics and f'{lifter}_alive_s' in r.metrics]
+      if len(pairs) < 3: continue
+      xs, ys = zip(*pairs)
+      try:
+        print(f'{lifter} {k}: r = {statistics.correlation(xs, ys):.3f} (n = {len(pairs)})')
+      except statistics.StatisticsError:
+        pass
 
 
 def main(argv):
   assert len(argv) >= 2, "log directory required as first argument"
   assert len(argv) >= 3, "out file required as second argument"
+  # optional third argument: timings file written by schedule.py, to
+  # correlate alive-tv time with the IR metrics.
 
   from pathlib import Path
 
   fname = argv[1]
+  times = load_alive_times(argv[3]) if len(argv) >= 4 else {}
   results = []
   for d in Path(fname).iterdir():
     if not d.is_dir(): continue 
@@ -167,16 +217,28 @@ def main(argv):
         x = parse_op(PeekIterator(iter(file)), f.stem)
         x.category = d.name
         x.errors = f.with_suffix('.err').read_text()
+        for lifter in ['cap', 'rem']:
+          if (x.opcode, lifter) in times:
+            x.metrics[f'{lifter}_alive_s'] = times[x.opcode, lifter]
 
         results.append(x)
 
   print(len(results))
 
+  def row(x: Result) -> dict:
+    d = dict(x.__dict__)
+    d.update(d.pop('metrics'))
+    return d
+
+  metric_fields = sorted({k for x in results for k in x.metrics})
   with open(argv[2], 'w', newline='') as f:
-    fields = list(results[0].__dict__.keys())
+    fields = [k for k in results[0].__dict__.keys() if k != 'metrics'] + metric_fields
     w = csv.DictWriter(f, fields)
     w.writeheader()
-    w.writerows((x.__dict__ for x in results))
+    w.writerows((row(x) for x in results))
+
+  if times:
+    print_correlations(results)
 
 if __name__ == '__main__':
   import sys
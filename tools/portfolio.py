@@ -0,0 +1,148 @@
+#!/usr/bin/env python3
+
+# races several solver configurations on queries run at the full timeout,
+# used by glue.sh when $PORTFOLIO is set.
+#
+#   portfolio.py race [--jobs N] [--dump DIR] -- ALIVE_ARGS...
+#     runs alive-tv with ALIVE_ARGS under N configurations in parallel (Z3
+#     random seeds, which change its search but not the query; other solvers
+#     and tactics are only raced offline by solve) and prints the
+#     output of the first to give a definite verdict, killing the rest. if
+#     none does, prints the output of the default configuration. exits 0 if
+#     the verdict is equivalent.
+#     with --dump, the default configuration also writes its queries as
+#     SMT-LIB files to DIR (see $ALIVE_SMT_DUMP below).
+#
+#   portfolio.py solve [--timeout MS] FILE.smt2...
+#     races the locally installed solvers over each dumped query, with Z3
+#     both as is and bit-blasting, and prints one line per query:
+#     FILE ANSWER SOLVER SECONDS. alive-tv decides a verdict from several
+#     queries, so this is for finding which solvers are worth adding, not a
+#     verdict.
+
+import os
+import shutil
+import subprocess
+import tempfile
+import time
+
+from concurrent.futures import ThreadPoolExecutor, FIRST_COMPLETED, wait
+from pathlib import Path
+
+# alive-tv flag which writes each SMT query to a directory.
+DUMP_FLAG = os.environ.get('ALIVE_SMT_DUMP', '--smt-bench-dir')
+
+Z3_TACTICS = {
+  'z3': None,
+  'z3-bitblast': '(then simplify bit-blast sat)',
+  'z3-qfbv': 'qfbv',
+}
+SOLVERS = {
+  'cvc5': ['cvc5', '--lang=smt2'],
+  'bitwuzla': ['bitwuzla'],
+  'yices': ['yices-smt2'],
+}
+
+
+def definite(out: str) -> bool:
+  return 'seem to be equivalent' in out or "doesn't verify" in out
+
+
+def start(args: list[str]) -> subprocess.Popen:
+  return subprocess.Popen(args, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True,
+                          start_new_session=True)
+
+
+def kill(p: subprocess.Popen) -> None:
+  if p.poll() is None:
+    os.killpg(p.pid, 9)
+  p.wait()
+
+
+def first_definite(procs: dict[str, subprocess.Popen], answer) -> tuple[str | None, str | dict]:
+  """Waits for the processes, returning the name and output of the first
+  whose output satisfies answer and killing the rest. If none does, returns
+  None and the outputs of all of them by name."""
+  outputs = {}
+  with ThreadPoolExecutor(len(procs)) as pool:
+    pending = {pool.submit(lambda p: p.communicate()[0], p): name for name, p in procs.items()}
+    while pending:
+      done, _ = wait(pending, return_when=FIRST_COMPLETED)
+      for f in done:
+        name = pending.pop(f)
+        outputs[name] = f.result()
+        if answer(outputs[name]):
+          for p in procs.values():
+            kill(p)
+          return name, outputs[name]
+  return None, outputs
+
+
+def race(jobs: int, dump: str | None, alive_args: list[str]) -> int:
+  alive = os.environ.get('ALIVE', 'alive-tv')
+  configs = {'default': []}
+  for seed in range(1, jobs):
+    configs[f'seed{seed}'] = [f'--smt-random-seed={seed}']
+  if dump:
+    Path(dump).mkdir(parents=True, exist_ok=True)
+    configs['default'] = [f'{DUMP_FLAG}={dump}']
+
+  procs = {name: start([alive, *extra, *alive_args]) for name, extra in configs.items()}
+  name, out = first_definite(procs, definite)
+  if name is None:
+    name, out = 'default', out['default']
+  print(f'portfolio: {name} of {len(configs)} configurations')
+  print(out, end='')
+  return 0 if 'seem to be equivalent' in out else 1
+
+
+def solve(timeout: int, files: list[str]) -> None:
+  for fname in files:
+    query = Path(fname).read_text()
+    with tempfile.TemporaryDirectory() as tmp:
+      procs = {}
+      if shutil.which('z3'):
+        for name, tactic in Z3_TACTICS.items():
+          q = query if tactic is None else query.replace('(check-sat)', f'(check-sat-using {tactic})')
+          Path(tmp, name).write_text(q)
+          procs[name] = start(['z3', f'-t:{timeout}', str(Path(tmp, name))])
+      for name, cmd in SOLVERS.items():
+        if shutil.which(cmd[0]):
+          procs[name] = start([*cmd, fname])
+      if not procs:
+        print(f'{fname} unknown none 0')
+        continue
+
+      begin = time.monotonic()
+      answer = lambda out: out.split()[:1] in (['sat'], ['unsat'])
+      name, out = first_definite(procs, answer)
+      secs = time.monotonic() - begin
+      if name is None:
+        print(f'{fname} unknown none {secs:.2f}')
+      else:
+        print(f'{fname} {out.split()[0]} {name} {secs:.2f}')
+
+
+def main(argv):
+  args = argv[1:]
+  assert args and args[0] in ('race', 'solve'), "usage: portfolio.py race|solve ..."
+  cmd = args.pop(0)
+  jobs, dump, timeout = min(4, os.cpu_count() or 1), None, 20000
+  rest = []
+  while args:
+    a = args.pop(0)
+    if a == '--jobs': jobs = int(args.pop(0))
+    elif a == '--dump': dump = args.pop(0)
+    elif a == '--timeout': timeout = int(args.pop(0))
+    elif a == '--': rest += args; args = []
+    else: rest.append(a)
+
+  if cmd == 'race':
+    assert rest, "usage: portfolio.py race [--jobs N] [--dump DIR] -- ALIVE_ARGS..."
+    return race(jobs, dump, rest)
+  solve(timeout, rest)
+  return 0
+
+if __name__ == '__main__':
+  import sys
+  sys.exit(main(sys.argv))
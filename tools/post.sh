@@ -1,6 +1,8 @@
 #!/bin/bash
 
+# pass pipelines are named in presets.txt, chosen with $PASS_PRESET.
+presets="${PASS_PRESETS:-$(dirname "$0")/presets.txt}"
+passes=$(awk -v p="${PASS_PRESET:-default}" '$1 == p { print $2 }' "$presets")
+[[ -z "$passes" ]] && { echo "unknown pass preset '${PASS_PRESET:-default}'" >&2; exit 1; }
 
-opt -S -opaque-pointers -passes=inline,mergereturn,mem2reg,gvn,early-cse,simplifycfg,tailcallelim,simplifycfg,instcombine,gvn,dce
-#opt -S -opaque-pointers -passes=inline,mergereturn,simplifycfg,mem2reg,dce,dse,sink,sccp,gvn,dse,dce,verify
-#opt -S -opaque-pointers -passes=inline,mergereturn,gvn,mem2reg,dce,dse,sink,dse,mem2reg,dce,verify
+opt -S -opaque-pointers -passes=$passes
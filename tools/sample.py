@@ -0,0 +1,258 @@
+#!/usr/bin/env python3
+
+# generates opcodes for bulk.sh by sampling each encoding's fields, rather
+# than sweeping the fixed coverage lists.
+#
+#   sample.py [--budget N] [--seed S] [--no-filter] [--template] COVERAGE_FILE...
+#
+# opcodes are printed in the same big-endian 0x format as the coverage files.
+# with --template, opcodes are printed for each encoding with register
+# fields, one per way the fields can alias, followed by those fields and
+# their values (e.g. Rd=1,Rn=1,Rm=2) and another instance of the encoding,
+# for glue.sh to generalise over (see template). the other instance is also
+# printed on its own line. the registers chosen are below 30.
+#
+# the coverage files list opcodes with their encoding fields, e.g.
+#   0x0b000000: [sf=0 ; op=0 ; S=0 ; shift=0 ; Rm=0 ; imm6=0 ; Rn=0 ; Rd=0] --> OK
+# lines with the same field names are taken to be one encoding. the position
+# of each field is recovered from the opcode bits which vary across the
+# encoding's opcodes, by how they line up with the bits of its values, and
+# its width from the contiguous bits around them, so a field is sampled over
+# its full range even if the listed values are small. other bits which are
+# constant over the opcodes are fixed, as are fields which never vary. bits
+# which vary but match no field become anonymous fields.
+#
+# each field is then divided into strata depending on what it encodes
+# (registers, condition codes, shift amounts and immediates, small enums)
+# and up to N opcodes per encoding are drawn so that every field cycles
+# through its strata. unless --no-filter is given, opcodes which llvm-mc
+# cannot decode are dropped.
+
+import random
+import re
+
+from dataclasses import dataclass
+from math import gcd
+
+from schedule import mnemonics
+
+REGISTER = re.compile(r'^R[a-z]\d?$')
+
+
+@dataclass
+class Field:
+  name: str
+  bits: list[int]  # opcode bit positions, least significant first
+
+  @property
+  def width(self) -> int:
+    return len(self.bits)
+
+  def strata(self, rng: random.Random) -> list[int]:
+    top = (1 << self.width) - 1
+    if self.width <= 2:
+      return list(range(top + 1))
+    if self.name == 'cond':
+      return list(range(16))
+    if REGISTER.match(self.name):
+      # 31 is SP or ZR depending on the instruction, 30 is the link register.
+      return [0, 1, rng.randrange(2, 30), 30, 31]
+    # immediates, shift amounts and anything else: boundaries plus interior.
+    vals = [0, 1, top >> 1, (top >> 1) + 1, top - 1, top, rng.randrange(top + 1)]
+    return list(dict.fromkeys(vals))
+
+  def encode(self, value: int) -> int:
+    return sum(((value >> k) & 1) << p for k, p in enumerate(self.bits))
+
+
+@dataclass
+class Encoding:
+  fixed_mask: int
+  fixed_bits: int
+  fields: list[Field]
+
+
+def parse_coverage(fname: str) -> dict[tuple[str, ...], list[tuple[int, dict[str, int]]]]:
+  """Groups OK opcodes in a coverage file by their field names."""
+  groups = {}
+  with open(fname) as f:
+    for line in f:
+      if ' --> OK' not in line: continue
+      op = int(line.split(':', 1)[0], 16)
+      fields = {}
+      if m := re.search(r'\[(.*)\]', line):
+        for pair in re.split(r'[;,]', m.group(1)):
+          k, _, v = pair.partition('=')
+          v = v.strip()
+          # quoted values are ASL bitvector literals, others are integers.
+          quoted = v[:1] in ("'", '"')
+          v = v.strip("'\"")
+          try:
+            fields[k.strip()] = int(v, 2) if quoted else int(v, 0)
+          except ValueError:
+            continue
+      groups.setdefault(tuple(sorted(fields)), []).append((op, fields))
+  return groups
+
+
+def infer_encoding(ops: list[tuple[int, dict[str, int]]]) -> Encoding:
+  def bit(x, i): return (x >> i) & 1
+
+  first, first_vals = ops[0]
+  variable = [i for i in range(32) if any(bit(op, i) != bit(first, i) for op, _ in ops)]
+  fixed_mask = 0xffffffff & ~sum(1 << i for i in variable)
+
+  used = set()
+  fields = []
+  for name in first_vals:
+    # each bit of the field's values which varies is matched to an opcode bit
+    # which varies alike, whatever the largest value listed.
+    found = {}
+    for k in range(32):
+      col = [bit(vals[name], k) for _, vals in ops]
+      if len(set(col)) < 2: continue
+      candidates = [p for p in variable if p not in used and p not in found.values()
+                    and all(bit(op, p) == c for (op, _), c in zip(ops, col))]
+      if not candidates: continue
+      # prefer the bit following the previous one, since fields are contiguous.
+      prev = found.get(k - 1)
+      found[k] = prev + 1 if prev is not None and prev + 1 in candidates else candidates[0]
+    # a field which never varies cannot be located, and stays fixed.
+    if not found: continue
+    starts = {p - k for k, p in found.items()}
+    if len(starts) != 1:
+      continue  # not contiguous, its bits become anonymous fields below.
+    start = starts.pop()
+
+    # the field's other bits are fixed in every listed opcode. they lie
+    # between and beyond its varying bits, up to the widest value listed
+    # (registers are always 5 bits), where the opcode agrees with the value.
+    width = max(max(found) + 1, max(vals[name] for _, vals in ops).bit_length(),
+                5 if REGISTER.match(name) else 0)
+    bits = []
+    for k in range(min(width, 32 - start)):
+      p = start + k
+      if k not in found and (p in variable or p in used or bit(first, p) != bit(first_vals[name], k)):
+        break
+      bits.append(p)
+    if len(bits) <= max(found):
+      continue
+    used.update(bits)
+    fields.append(Field(name, bits))
+
+  # remaining variable bits, as contiguous runs.
+  runs = []
+  for i in variable:
+    if i in used: continue
+    if runs and runs[-1][-1] == i - 1:
+      runs[-1].append(i)
+    else:
+      runs.append([i])
+  fields += [Field(f'bits{r[0]}_{r[-1]}', r) for r in runs]
+
+  # bits of fields which did not vary in the listed opcodes are not fixed.
+  fixed_mask &= ~sum(1 << p for f in fields for p in f.bits)
+  return Encoding(fixed_mask, first & fixed_mask, fields)
+
+
+def sample(enc: Encoding, budget: int, rng: random.Random) -> list[int]:
+  strata = [f.strata(rng) for f in enc.fields]
+  # a different stride per field, so that fields do not move in lockstep.
+  # strides are coprime with the stratum count, so every stratum is visited.
+  strides = [rng.choice([k for k in range(1, len(s)) if gcd(k, len(s)) == 1] or [1]) for s in strata]
+  offsets = [rng.randrange(len(s)) for s in strata]
+
+  out = []
+  seen = set()
+  for i in range(budget * 4):
+    if len(out) >= budget: break
+    op = enc.fixed_bits
+    for f, s, stride, offset in zip(enc.fields, strata, strides, offsets):
+      op |= f.encode(s[(offset + i * stride) % len(s)])
+    if op not in seen:
+      seen.add(op)
+      out.append(op)
+  return out
+
+
+def partitions(items: list) -> list[list[list]]:
+  """Every way of dividing items into groups."""
+  if not items:
+    return [[]]
+  first, rest = items[0], items[1:]
+  out = []
+  for p in partitions(rest):
+    out.append([[first]] + p)
+    out += [p[:i] + [[first] + g] + p[i + 1:] for i, g in enumerate(p)]
+  return out
+
+
+def template(enc: Encoding, base: int) -> tuple[list[tuple[int, str]], int] | None:
+  """Opcodes of the encoding to template over its register fields, each with
+  the fields' values, and another instance of the encoding. there is one
+  opcode for each way the fields can alias (e.g. Rd=1,Rn=1,Rm=2), as each
+  template only covers distinct registers. the other instance's fields
+  select none of their registers, so glue.sh can tell implicit registers
+  apart, and it is also compared concretely to check the templates.
+  None unless every varying bit was matched to a field, since an unmatched
+  register field would stay fixed and could alias a templated one."""
+  regs = [f for f in enc.fields if REGISTER.match(f.name)]
+  if not regs or any(f.name.startswith('bits') for f in enc.fields):
+    return None
+  if any(f.bits != list(range(f.bits[0], f.bits[0] + f.width)) for f in regs):
+    return None
+  if any(2 * len(regs) >= min(30, 1 << f.width) for f in regs):
+    return None
+
+  def instance(nums) -> int:
+    op = base
+    for num, f in zip(nums, regs):
+      op = op & ~f.encode((1 << f.width) - 1) | f.encode(num)
+    return op
+
+  ops = []
+  for p in partitions(regs):
+    num = {f.name: i for i, group in enumerate(p, 1) for f in group}
+    ops.append((instance(num[f.name] for f in regs), ','.join(f'{f.name}={num[f.name]}' for f in regs)))
+  return ops, instance(range(len(regs) + 1, 2 * len(regs) + 1))
+
+
+def main(argv):
+  args = argv[1:]
+  budget, seed, filter, templates = 64, 0, True, False
+  files = []
+  while args:
+    a = args.pop(0)
+    if a == '--budget': budget = int(args.pop(0))
+    elif a == '--seed': seed = int(args.pop(0))
+    elif a == '--no-filter': filter = False
+    elif a == '--template': templates = True
+    else: files.append(a)
+  assert files, "requires coverage files as arguments"
+
+  rng = random.Random(seed)
+  ops = []
+  fields = {}
+  others = {}
+  for fname in files:
+    for group in parse_coverage(fname).values():
+      if templates:
+        if t := template(infer_encoding(group), group[0][0]):
+          for op, f in t[0]:
+            ops.append(op)
+            fields[op], others[op] = f, t[1]
+          ops.append(t[1])
+      else:
+        ops += sample(infer_encoding(group), budget, rng)
+
+  if filter:
+    valid = mnemonics([op.to_bytes(4, 'little').hex() for op in ops])
+    ok = lambda op: op.to_bytes(4, 'little').hex() in valid
+    ops = [op for op in ops if ok(op) and (op not in others or ok(others[op]))]
+
+  for op in dict.fromkeys(ops):
+    print(f'0x{op:08x}' + (f' {fields[op]} 0x{others[op]:08x}' if op in fields else ''))
+
+if __name__ == '__main__':
+  import sys
+  main(sys.argv)
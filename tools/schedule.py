@@ -0,0 +1,180 @@
+#!/usr/bin/env python3
+
+# cost model over historical alive-tv timings, used by bulk.sh and glue.sh.
+#
+#   schedule.py order < jobs > jobs
+#     reads lines whose first field is a little-endian opcode and prints them
+#     sorted by decreasing expected verification time (longest first), so that
+#     xargs -P does not leave the slowest opcodes at the tail of a sweep.
+#
+#   schedule.py timeout OPCODE MNEMONIC LIFTER
+#     prints the initial --smt-to (in ms) to use for this opcode and lifter.
+#     likely-cheap opcodes get a short timeout; glue.sh escalates to
+#     $SMT_TIMEOUT only if that times out.
+#
+#   schedule.py record OPCODE MNEMONIC LIFTER TIMEOUT SECONDS VERDICT
+#     appends one timing to the database.
+#
+# timings are stored as tab-separated lines in $TIMINGS (see env.sh).
+
+import os
+import statistics
+import subprocess
+import sys
+
+from collections import defaultdict
+from dataclasses import dataclass
+
+LIFTERS = ['cap', 'rem']
+
+# initial timeout is this multiple of the slowest previous time.
+SAFETY = 4
+MIN_TIMEOUT = 2000
+
+
+@dataclass
+class Timing:
+  opcode: str
+  mnemonic: str
+  lifter: str
+  timeout: int
+  seconds: float
+  verdict: str
+
+  @property
+  def timed_out(self) -> bool:
+    return self.verdict == 'timeout'
+
+
+def max_timeout() -> int:
+  return int(os.environ.get('SMT_TIMEOUT', '20000'))
+
+
+def timings_file() -> str:
+  return os.environ.get('TIMINGS') or os.path.expanduser('~/.cache/llvm-translator/timings.tsv')
+
+
+def load_timings() -> list[Timing]:
+  out = []
+  try:
+    with open(timings_file()) as f:
+      for line in f:
+        fields = line.rstrip('\n').split('\t')
+        if len(fields) != 6: continue
+        op, mnem, lifter, to, secs, verdict = fields
+        try:
+          out.append(Timing(op, mnem, lifter, int(to), float(secs), verdict))
+        except ValueError:
+          continue
+  except FileNotFoundError:
+    pass
+  return out
+
+
+class CostModel:
+  """Expected alive-tv time per (opcode, lifter), falling back to the
+  mnemonic and then to the lifter-wide median."""
+
+  def __init__(self, timings: list[Timing]):
+    self.by_op = defaultdict(list)
+    self.by_mnem = defaultdict(list)
+    self.by_lifter = defaultdict(list)
+    for t in timings:
+      self.by_op[t.opcode, t.lifter].append(t)
+      self.by_mnem[t.mnemonic, t.lifter].append(t)
+      self.by_lifter[t.lifter].append(t)
+
+  @staticmethod
+  def cost(ts: list[Timing]) -> float:
+    # a timeout at the full limit means we know nothing except that it is slow.
+    if any(t.timed_out and t.timeout >= max_timeout() for t in ts):
+      return max_timeout() / 1000
+    done = [t.seconds for t in ts if not t.timed_out]
+    if not done:
+      return max(t.timeout for t in ts) / 1000
+    return max(done)
+
+  def expected(self, op: str, mnem: str, lifter: str) -> tuple[float, bool]:
+    """Returns expected seconds and whether it was derived from history of
+    this opcode or mnemonic (as opposed to a global guess)."""
+    if ts := self.by_op.get((op, lifter)):
+      return self.cost(ts), True
+    if mnem and (ts := self.by_mnem.get((mnem, lifter))):
+      return statistics.median(self.cost([t]) for t in ts), True
+    if ts := self.by_lifter.get(lifter):
+      return statistics.median(self.cost([t]) for t in ts), False
+    return max_timeout() / 1000, False
+
+  def timeout(self, op: str, mnem: str, lifter: str) -> int:
+    secs, known = self.expected(op, mnem, lifter)
+    if not known:
+      return max_timeout()
+    ms = int(secs * 1000 * SAFETY)
+    return max(MIN_TIMEOUT, min(ms, max_timeout()))
+
+
+def mnemonics(ops: list[str]) -> dict[str, str]:
+  """Disassembles all opcodes with a single llvm-mc call.
+  Results are matched up by the printed encoding, since invalid opcodes
+  produce no output line."""
+  def le_bytes(op):
+    return ' '.join('0x' + op[i:i+2] for i in range(0, 8, 2))
+
+  text = '\n'.join(le_bytes(op) for op in ops) + '\n'
+  try:
+    p = subprocess.run(
+      ['llvm-mc', '--arch', 'arm64', '-mattr=+crc,+flagm,+neon,+sve,+sve2,+dotprod,+fp-armv8,+sme,+v8.6a',
+       '--disassemble', '-show-encoding'],
+      input=text, capture_output=True, text=True)
+  except FileNotFoundError:
+    return {}
+
+  out = {}
+  for line in p.stdout.splitlines():
+    if '// encoding: [' not in line: continue
+    asm, enc = line.split('// encoding: [')
+    op = ''.join(b[2:] for b in enc.rstrip(']').split(','))
+    out[op.lower()] = asm.split()[0] if asm.split() else ''
+  return out
+
+
+def order(lines: list[str], model: CostModel) -> list[str]:
+  ops = [l.split()[0] for l in lines]
+  mnems = mnemonics(ops)
+
+  def key(i: int) -> float:
+    op = ops[i]
+    return sum(model.expected(op, mnems.get(op.lower(), ''), l)[0] for l in LIFTERS)
+
+  # stable, so equally unknown jobs keep their input order.
+  idx = sorted(range(len(lines)), key=key, reverse=True)
+  return [lines[i] for i in idx]
+
+
+def main(argv):
+  if len(argv) < 2:
+    sys.exit("usage: schedule.py order|timeout|record ...")
+  cmd = argv[1]
+
+  if cmd == 'order':
+    lines = [l.rstrip('\n') for l in sys.stdin if l.strip()]
+    for l in order(lines, CostModel(load_timings())):
+      print(l)
+  elif cmd == 'timeout':
+    if len(argv) != 5:
+      sys.exit("usage: schedule.py timeout OPCODE MNEMONIC LIFTER")
+    _, _, op, mnem, lifter = argv
+    print(CostModel(load_timings()).timeout(op, mnem, lifter))
+  elif cmd == 'record':
+    if len(argv) != 8:
+      sys.exit("usage: schedule.py record OPCODE MNEMONIC LIFTER TIMEOUT SECONDS VERDICT")
+    fname = timings_file()
+    os.makedirs(os.path.dirname(fname), exist_ok=True)
+    # single small append, so concurrent glue.sh processes do not interleave.
+    with open(fname, 'a') as f:
+      f.write('\t'.join(argv[2:]) + '\n')
+  else:
+    sys.exit("unknown command: " + cmd)
+
+if __name__ == '__main__':
+  main(sys.argv)
@@ -0,0 +1,230 @@
+#!/usr/bin/env python3
+
+# searches for the opt pass pipeline which minimises alive-tv time over a
+# sample of opcodes, and saves it as a named preset in presets.txt.
+#
+#   tune.py [--name NAME] [--sample N] [--mutations N] [--jobs N] [--repeats N] [--seed S]
+#           ARTIFACT_DIR
+#
+# ARTIFACT_DIR is a directory of lifter outputs written by glue.sh (e.g.
+# /tmp/2023-09-25), i.e. OP.cap, OP.rem and OP.asl. requires the variables
+# from env.sh, e.g. `. tools/env.sh && tools/tune.py /tmp/2023-09-25`.
+#
+# candidates are the existing presets plus random mutations of the default
+# one. each candidate is run over every sampled opcode, and is scored by total
+# alive-tv time (timeouts count as the full timeout), then by IR size, then
+# by pipeline length.
+# candidates are applied by post.sh, with a presets file holding just the
+# candidate, so they are measured on the same opt as the sweep.
+# candidates which change a definite verdict of the default pipeline are
+# rejected, since that means the passes changed what is being verified.
+# the passes are applied on --jobs threads, but alive-tv is timed one query
+# at a time, taking the median of --repeats runs (default 1), so that the
+# timings are not skewed by other work on the machine.
+
+import os
+import random
+import statistics
+import subprocess
+import tempfile
+import time
+
+from concurrent.futures import ThreadPoolExecutor
+from dataclasses import dataclass, field
+from pathlib import Path
+
+POST = Path(__file__).resolve().parent / 'post.sh'
+LIFTERS = ['cap', 'rem']
+# front of every pipeline, needed to inline capstone helpers and unify returns.
+PREFIX = ['inline', 'mergereturn']
+POOL = ['mem2reg', 'sroa', 'gvn', 'early-cse', 'simplifycfg', 'instcombine', 'instsimplify',
+        'dce', 'adce', 'dse', 'sccp', 'sink', 'reassociate', 'tailcallelim', 'bdce', 'aggressive-instcombine']
+
+
+@dataclass
+class Score:
+  pipeline: str
+  seconds: float = 0
+  insts: int = 0
+  verdicts: dict = field(default_factory=dict)  # (op, lifter) -> verdict
+  unstable: int = 0
+  broken: bool = False
+
+
+def env(name: str) -> str:
+  v = os.environ.get(name)
+  assert v, f"${name} not set, source tools/env.sh first"
+  return v
+
+
+def load_presets(fname: str) -> dict[str, str]:
+  presets = {}
+  with open(fname) as f:
+    for line in f:
+      words = line.split()
+      if len(words) == 2 and not line.startswith('#'):
+        presets[words[0]] = words[1]
+  return presets
+
+
+def save_preset(fname: str, name: str, pipeline: str) -> None:
+  lines = Path(fname).read_text().splitlines()
+  lines = [l for l in lines if l.startswith('#') or not l.split() or l.split()[0] != name]
+  lines.append(f'{name}\t{pipeline}')
+  Path(fname).write_text('\n'.join(lines) + '\n')
+
+
+def mutate(pipeline: str, rng: random.Random) -> str:
+  passes = pipeline.split(',')
+  head, tail = passes[:len(PREFIX)], passes[len(PREFIX):]
+  kind = rng.choice(['drop', 'insert', 'swap'])
+  if kind == 'drop' and len(tail) > 1:
+    del tail[rng.randrange(len(tail))]
+  elif kind == 'swap' and len(tail) > 1:
+    i = rng.randrange(len(tail) - 1)
+    tail[i], tail[i+1] = tail[i+1], tail[i]
+  else:
+    tail.insert(rng.randrange(len(tail) + 1), rng.choice(POOL))
+  return ','.join(head + tail)
+
+
+def run(args: list[str], **kw) -> subprocess.CompletedProcess:
+  return subprocess.run(args, capture_output=True, text=True, **kw)
+
+
+def translate(op: str, src: Path, work: Path) -> bool:
+  """Translates each lifter's raw output once, before any passes."""
+  for lifter in LIFTERS + ['asl']:
+    with open(work / f'{op}.{lifter}.raw.ll', 'w') as out:
+      p = subprocess.run([env('LLVM_TRANSLATOR'), lifter, str(src / f'{op}.{lifter}')],
+                         stdout=out, stderr=subprocess.DEVNULL)
+    if p.returncode != 0:
+      return False
+  return True
+
+
+def prepare(op: str, work: Path, outdir: Path) -> tuple[dict[str, Path], int] | None:
+  """Applies the candidate in outdir's presets file to one opcode and unifies
+  the results. Returns the modules and their instruction count, or None if the
+  pipeline fails on it."""
+  presets = outdir / 'presets.txt'
+  post_env = {**os.environ, 'PASS_PRESETS': str(presets), 'PASS_PRESET': 'tune'}
+  lls = {}
+  for lifter in LIFTERS + ['asl']:
+    lls[lifter] = outdir / f'{op}.{lifter}.ll'
+    with open(work / f'{op}.{lifter}.raw.ll') as raw, open(lls[lifter], 'w') as out:
+      p = subprocess.run([str(POST)], stdin=raw, stdout=out, stderr=subprocess.DEVNULL, env=post_env)
+    if p.returncode != 0:
+      return None
+  if run([env('LLVM_TRANSLATOR'), 'vars', *map(str, lls.values())]).returncode != 0:
+    return None
+
+  insts = 0
+  for ll in lls.values():
+    stats = run([env('LLVM_TRANSLATOR'), 'stats', 'tune', str(ll)]).stdout.split()
+    insts += int(next((s.split('=')[1] for s in stats if s.startswith('insts=')), 0))
+  return lls, insts
+
+
+def measure(op: str, lls: dict[str, Path], repeats: int) -> tuple[float, dict]:
+  """Returns alive-tv seconds and verdicts for one opcode. the seconds of each
+  lifter are the median of repeats runs."""
+  timeout = int(os.environ.get('SMT_TIMEOUT', '20000'))
+  seconds = 0.0
+  verdicts = {}
+  for lifter in LIFTERS:
+    times = []
+    for _ in range(repeats):
+      start = time.monotonic()
+      out = run([env('ALIVE'), '--bidirectional', '--disable-undef-input', '--disable-poison-input',
+                 f'--smt-to={timeout}', str(lls[lifter]), str(lls['asl'])]).stdout
+      if 'seem to be equivalent' in out:
+        verdicts[op, lifter] = 'equivalent'
+      elif 'Timeout' in out:
+        verdicts[op, lifter] = 'timeout'
+      else:
+        verdicts[op, lifter] = 'other'
+      elapsed = time.monotonic() - start
+      times.append(timeout / 1000 if verdicts[op, lifter] == 'timeout' else elapsed)
+    seconds += statistics.median(times)
+  return seconds, verdicts
+
+
+def score(pipeline: str, ops: list[str], work: Path, jobs: int, repeats: int) -> Score:
+  s = Score(pipeline)
+  with tempfile.TemporaryDirectory(dir=work) as outdir:
+    Path(outdir, 'presets.txt').write_text(f'tune {pipeline}\n')
+    with ThreadPoolExecutor(jobs) as pool:
+      prepared = list(pool.map(lambda op: prepare(op, work, Path(outdir)), ops))
+    # alive-tv is timed one query at a time, so candidates are not slowed
+    # down by each other or by the preparation of other opcodes.
+    for op, r in zip(ops, prepared):
+      if r is None:
+        s.broken = True
+        continue
+      lls, insts = r
+      secs, verdicts = measure(op, lls, repeats)
+      s.seconds += secs
+      s.insts += insts
+      s.verdicts.update(verdicts)
+  return s
+
+
+def main(argv):
+  args = argv[1:]
+  name, sample, mutations, seed, repeats = 'tuned', 50, 8, 0, 1
+  jobs = os.cpu_count() or 1
+  dirs = []
+  while args:
+    a = args.pop(0)
+    if a == '--name': name = args.pop(0)
+    elif a == '--sample': sample = int(args.pop(0))
+    elif a == '--mutations': mutations = int(args.pop(0))
+    elif a == '--jobs': jobs = int(args.pop(0))
+    elif a == '--seed': seed = int(args.pop(0))
+    elif a == '--repeats': repeats = int(args.pop(0))
+    else: dirs.append(Path(a))
+  assert len(dirs) == 1, "requires one artifact directory"
+  src = dirs[0]
+  rng = random.Random(seed)
+
+  presets_file = env('PASS_PRESETS')
+  presets = load_presets(presets_file)
+  candidates = list(dict.fromkeys(presets.values()))
+  for _ in range(mutations):
+    candidates.append(mutate(presets['default'], rng))
+  candidates = list(dict.fromkeys(candidates))
+
+  ops = sorted({f.name.split('.')[0] for f in src.glob('*.asl')
+                if all((src / f'{f.name.split(".")[0]}.{l}').exists() for l in LIFTERS)})
+  ops = rng.sample(ops, min(sample, len(ops)))
+
+  with tempfile.TemporaryDirectory() as tmp:
+    work = Path(tmp)
+    ops = [op for op in ops if translate(op, src, work)]
+    assert ops, "no opcodes could be translated"
+    print(f'tuning over {len(ops)} opcodes, {len(candidates)} candidates')
+
+    scores = [score(c, ops, work, jobs, repeats) for c in candidates]
+
+  # verdict changes against the default pipeline, ignoring timeouts.
+  reference = scores[candidates.index(presets['default'])]
+  for s in scores:
+    for k, v in s.verdicts.items():
+      ref = reference.verdicts.get(k)
+      if ref and 'timeout' not in (v, ref) and v != ref:
+        s.unstable += 1
+
+  scores.sort(key=lambda s: (s.broken or s.unstable > 0, s.seconds, s.insts, s.pipeline.count(',')))
+  for s in scores:
+    flag = 'broken' if s.broken else f'{s.unstable} changed' if s.unstable else 'ok'
+    print(f'{s.seconds:9.1f}s {s.insts:7d} insts  {flag:10}  {s.pipeline}')
+
+  best = scores[0]
+  assert not best.broken and best.unstable == 0, "no stable candidate"
+  save_preset(presets_file, name, best.pipeline)
+  print(f'saved {name}: {best.pipeline}')
+
+if __name__ == '__main__':
+  import sys
+  main(sys.argv)